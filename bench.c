@@ -0,0 +1,316 @@
+#include <errno.h>
+#include <string.h> // strerror
+#include <stdlib.h> // exit
+#include <time.h>
+
+#include "parser.h"
+#include "workspace.h"
+#include "typecheck.h"
+
+// Front-end throughput benchmark. Generates a synthetic program, then times lexing on its own
+// (find_next_token) and parsing on its own (parse_toplevel over a pre-lexed Token_Stream).
+
+_Thread_local Arena thread_temporary_arena = {0};
+Arena general_arena = {0};
+_Thread_local Arena *thread_context_arena = NULL; // Set in main(), see common.h.
+
+typedef enum {
+    SHAPE_PROCEDURES = 0,
+    SHAPE_EXPRESSIONS = 1,
+    SHAPE_ENUMS = 2,
+    SHAPE_STRINGS = 3,
+    SHAPE_MIXED = 4,
+} Shape;
+
+static const char *shape_names[] = {
+    [SHAPE_PROCEDURES]  = "procedures",
+    [SHAPE_EXPRESSIONS] = "expressions",
+    [SHAPE_ENUMS]       = "enums",
+    [SHAPE_STRINGS]     = "strings",
+    [SHAPE_MIXED]       = "mixed",
+};
+
+static double get_time_in_seconds(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void append(String_Builder *sb, const char *format, ...)
+{
+    char buffer[1024];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    assert(n >= 0 && (size_t)n < sizeof(buffer));
+    sb_append(sb, buffer, n);
+}
+
+// Lots of small procedures with a bit of control flow in each.
+static void generate_procedure(String_Builder *sb, int i)
+{
+    append(sb, "procedure_%d :: (a: int, b: int) -> int {\n", i);
+    append(sb, "    x := a * %d + b;\n", i % 97 + 1);
+    append(sb, "    if x > %d {\n", i % 1000);
+    append(sb, "        return x - b;\n");
+    append(sb, "    }\n");
+    append(sb, "    while x < 100 {\n");
+    append(sb, "        x += 1;\n");
+    append(sb, "    }\n");
+    append(sb, "    return x;\n");
+    append(sb, "}\n\n");
+}
+
+// One long expression, exercising operator precedence and nesting.
+static void generate_expression(String_Builder *sb, int i)
+{
+    static const char *operators[] = { "+", "-", "*", "/", "<<", "&", "|", "==", "<", "&&" };
+
+    append(sb, "expression_%d :: (a: int, b: int) -> int {\n    return ", i);
+    for (int term = 0; term < 64; term++) {
+        if (term > 0) append(sb, " %s ", operators[(i + term) % 10]);
+        switch (term % 4) {
+        case 0: append(sb, "a"); break;
+        case 1: append(sb, "%d", i * 31 + term); break;
+        case 2: append(sb, "(b - %d)", term); break;
+        case 3: append(sb, "-a"); break;
+        }
+    }
+    append(sb, ";\n}\n\n");
+}
+
+// Big flag enums, like SDL_WindowFlags.
+static void generate_enum(String_Builder *sb, int i)
+{
+    append(sb, "Window_Flags_%d :: enum u32 {\n", i);
+    for (int value = 0; value < 32; value++) {
+        append(sb, "    FLAG_%d_%d :: 1 << %d;\n", i, value, value);
+    }
+    append(sb, "}\n\n");
+}
+
+// C library bindings with string constants, some of them with escapes.
+static void generate_strings(String_Builder *sb, int i)
+{
+    append(sb, "library_%d :: #system_library \"libbinding_%d.so\";\n", i, i);
+    for (int binding = 0; binding < 8; binding++) {
+        append(sb, "binding_%d_%d :: (name: *u8, flags: u32, user_data: *void) -> s32 #foreign library_%d;\n", i, binding, i);
+    }
+    for (int constant = 0; constant < 8; constant++) {
+        if (constant % 4 == 0) {
+            append(sb, "MESSAGE_%d_%d :: \"Error %d:\\tsomething \\\"bad\\\" happened\\n\";\n", i, constant, constant);
+        } else {
+            append(sb, "MESSAGE_%d_%d :: \"A perfectly ordinary string constant without any escapes, number %d\";\n", i, constant, constant);
+        }
+    }
+    append(sb, "\n");
+}
+
+static String_View generate_program(Shape shape, size_t target_size)
+{
+    String_Builder sb = {0};
+    for (int i = 0; sb.count < target_size; i++) {
+        Shape current = (shape == SHAPE_MIXED) ? (Shape)(i % SHAPE_MIXED) : shape;
+        switch (current) {
+        case SHAPE_PROCEDURES:  generate_procedure(&sb, i);  break;
+        case SHAPE_EXPRESSIONS: generate_expression(&sb, i); break;
+        case SHAPE_ENUMS:       generate_enum(&sb, i);       break;
+        case SHAPE_STRINGS:     generate_strings(&sb, i);    break;
+        case SHAPE_MIXED:       UNREACHABLE;
+        }
+    }
+    return sv_from_parts(sb.data, sb.count);
+}
+
+static size_t arena_bytes_used(const Arena *arena)
+{
+    size_t result = 0;
+    for (Region *r = arena->begin; r != NULL; r = r->next) result += r->count * sizeof(uintptr_t);
+    return result;
+}
+
+static Source_File make_source_file(String_View source)
+{
+    Source_File file = {0};
+    file.name = (String_View)SV_STATIC("(benchmark)");
+    file.path = (String_View)SV_STATIC("(benchmark)");
+    file.data = (char *)source.data;
+    file.size = source.count;
+    file.ownership = SOURCE_FILE_MALLOCED; // Never freed, the workspace is thrown away without disposing it.
+    return file;
+}
+
+typedef struct {
+    double seconds; // Best of all iterations.
+    size_t tokens;
+    size_t ast_bytes;
+} Measurement;
+
+static Measurement benchmark_lexer(String_View source, int iterations)
+{
+    Measurement m = {0};
+    m.seconds = 1e300;
+
+    for (int i = 0; i < iterations; i++) {
+        Arena arena = {0};
+        Push_Arena(&arena);
+
+        Workspace w;
+        workspace_init(&w, "Benchmark");
+        arrput(w.files, make_source_file(source));
+        Parser *parser = parser_init(&w, 0);
+
+        size_t tokens = 0;
+        double start = get_time_in_seconds();
+        while (find_next_token(parser).type != TOKEN_END_OF_INPUT) tokens += 1;
+        double seconds = get_time_in_seconds() - start;
+
+        if (parser->reported_error) exit(1);
+        if (seconds < m.seconds) m.seconds = seconds;
+        m.tokens = tokens;
+
+        parser_free(parser);
+        ast_pools_reset();
+        atom_table_free(&w.atoms);
+        Pop_Arena();
+        arena_free(&arena);
+        arena_free(&temporary_arena);
+    }
+    return m;
+}
+
+static Measurement benchmark_parser(String_View source, int iterations)
+{
+    Measurement m = {0};
+    m.seconds = 1e300;
+
+    for (int i = 0; i < iterations; i++) {
+        Arena arena = {0};
+        Push_Arena(&arena);
+
+        Workspace w;
+        workspace_init(&w, "Benchmark");
+        arrput(w.files, make_source_file(source));
+        Parser *parser = parser_init(&w, 0);
+        parser->current_block = w.global_block;
+        parser_tokenize_entire_file(parser);
+
+        // Everything the parser allocates from here on is AST.
+        Arena ast_arena = {0};
+        parser->arena = &ast_arena;
+        size_t pool_bytes = ast_pools_bytes_used(); // The workspace's own type definitions.
+        double seconds;
+        {
+            Push_Arena(&ast_arena);
+            double start = get_time_in_seconds();
+            parse_toplevel(parser);
+            seconds = get_time_in_seconds() - start;
+            Pop_Arena();
+        }
+
+        if (parser->reported_error) exit(1);
+        if (seconds < m.seconds) m.seconds = seconds;
+        m.tokens = arrlen(parser->token_stream->types);
+        m.ast_bytes = arena_bytes_used(&ast_arena) + ast_pools_bytes_used() - pool_bytes;
+
+        parser_free(parser);
+        arena_free(&ast_arena);
+        ast_pools_reset();
+        atom_table_free(&w.atoms);
+        Pop_Arena();
+        arena_free(&arena);
+        arena_free(&temporary_arena);
+    }
+    return m;
+}
+
+static void print_measurement(const char *phase, Measurement m, size_t source_bytes)
+{
+    printf("%-8s %9.3f ms %10.2f Mtokens/s %9.2f MB/s", phase, m.seconds * 1000.0,
+        (double)m.tokens / m.seconds / 1e6, (double)source_bytes / m.seconds / 1e6);
+    if (m.ast_bytes) printf(" %7.2f AST bytes/source byte", (double)m.ast_bytes / (double)source_bytes);
+    printf("\n");
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [--shape procedures|expressions|enums|strings|mixed] [--size <KB>] [--iterations <n>] [--dump <path>]\n", program);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    context_arena = &general_arena;
+
+    const char *program = shift_args(&argc, &argv);
+
+    Shape shape = SHAPE_MIXED;
+    size_t size_kb = 4096;
+    int iterations = 5;
+    const char *dump_path = NULL;
+
+    while (argc) {
+        const char *flag = shift_args(&argc, &argv);
+        if (!argc) usage(program);
+        const char *value = shift_args(&argc, &argv);
+
+        if (strcmp(flag, "--shape") == 0) {
+            size_t i = 0;
+            for (; i < sizeof(shape_names) / sizeof(shape_names[0]); i++) {
+                if (strcmp(value, shape_names[i]) == 0) break;
+            }
+            if (i == sizeof(shape_names) / sizeof(shape_names[0])) usage(program);
+            shape = (Shape)i;
+        } else if (strcmp(flag, "--size") == 0) {
+            size_kb = strtoul(value, NULL, 10);
+        } else if (strcmp(flag, "--iterations") == 0) {
+            iterations = atoi(value);
+        } else if (strcmp(flag, "--dump") == 0) {
+            dump_path = value;
+        } else {
+            usage(program);
+        }
+    }
+    if (size_kb == 0 || iterations <= 0) usage(program);
+
+    String_View source = generate_program(shape, size_kb * 1024);
+
+    if (dump_path) {
+        FILE *f = fopen(dump_path, "wb");
+        if (!f) {
+            fprintf(stderr, "Error: Could not open '%s': %s\n", dump_path, strerror(errno));
+            exit(1);
+        }
+        fwrite(source.data, 1, source.count, f);
+        fclose(f);
+    }
+
+    printf("Shape: %s, %.2f MB, best of %d\n", shape_names[shape], (double)source.count / 1e6, iterations);
+    print_measurement("Lexing", benchmark_lexer(source, iterations), source.count);
+    print_measurement("Parsing", benchmark_parser(source, iterations), source.count);
+    return 0;
+}
+
+char *shift_args(int *argc, char ***argv)
+{
+    assert(*argc > 0);
+    char *result = **argv;
+    *argv += 1;
+    *argc -= 1;
+    return result;
+}
+
+#define STRING_BUILDER_IMPLEMENTATION
+#include "string_builder.h"
+#define CONTEXT_ALLOC_IMPLEMENTATION
+#include "vendor/context_alloc.h"
+#define STB_DS_IMPLEMENTATION
+#include "vendor/stb_ds.h"
+#define SV_IMPLEMENTATION
+#include "vendor/sv.h"
+#define ARENA_IMPLEMENTATION
+#include "vendor/arena.h"
+#define STB_SPRINTF_IMPLEMENTATION
+#include "vendor/stb_sprintf.h"
@@ -18,6 +18,24 @@ typedef uint16_t u16;
 typedef uint32_t u32;
 typedef uint64_t u64;
 
+// THREAD LOCAL ARENAS
+
+// The vendored allocator knows one context_arena and one temporary_arena, but we allocate on
+// several threads. Like errno, those names stand for this thread's own copy. Only the main thread
+// starts out with a context arena (general_arena), jobs on worker threads push their own before
+// allocating, and context_alloc() asserts if they forget.
+
+#include "vendor/arena.h"
+
+extern _Thread_local Arena *thread_context_arena;
+extern _Thread_local Arena thread_temporary_arena;
+
+static inline Arena **context_arena_of_this_thread(void)  { return &thread_context_arena; }
+static inline Arena *temporary_arena_of_this_thread(void) { return &thread_temporary_arena; }
+
+#define context_arena   (*context_arena_of_this_thread())
+#define temporary_arena (*temporary_arena_of_this_thread())
+
 #include "vendor/context_alloc.h"
 #include "vendor/stb_ds.h"
 
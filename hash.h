@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// @Volatile: nobuild.c uses this to generate the perfect hash in keywords.h, so changing it means
+// the keyword table has to be regenerated.
+
+#define IDENTIFIER_HASH_BASIS 2166136261u
+#define IDENTIFIER_HASH_PRIME 16777619u
+
+// FNV-1a. Every identifier gets hashed once by the lexer and the hash travels with the token.
+static inline uint32_t hash_identifier(const char *data, size_t count)
+{
+    uint32_t hash = IDENTIFIER_HASH_BASIS;
+    for (size_t i = 0; i < count; i++) {
+        hash ^= (uint8_t) data[i];
+        hash *= IDENTIFIER_HASH_PRIME;
+    }
+    return hash;
+}
+
+// Maps an identifier hash to a slot in a table of (1 << bits) entries.
+static inline uint32_t hash_to_slot(uint32_t hash, uint32_t seed, int bits)
+{
+    return (hash * seed) >> (32 - bits);
+}
@@ -0,0 +1,42 @@
+// Generated by nobuild.c, do not edit. Change the keyword lists in there instead.
+// Included by token.c, which defines Keyword_Entry.
+
+#pragma once
+
+#define KEYWORD_TABLE_BITS 6
+#define KEYWORD_TABLE_SEED 339u
+
+static const Keyword_Entry keyword_table[1 << KEYWORD_TABLE_BITS] = {
+    [49] = { "if", 2, TOKEN_KEYWORD_IF },
+    [27] = { "then", 4, TOKEN_KEYWORD_THEN },
+    [17] = { "else", 4, TOKEN_KEYWORD_ELSE },
+    [1] = { "for", 3, TOKEN_KEYWORD_FOR },
+    [22] = { "return", 6, TOKEN_KEYWORD_RETURN },
+    [21] = { "struct", 6, TOKEN_KEYWORD_STRUCT },
+    [15] = { "while", 5, TOKEN_KEYWORD_WHILE },
+    [44] = { "break", 5, TOKEN_KEYWORD_BREAK },
+    [62] = { "continue", 8, TOKEN_KEYWORD_CONTINUE },
+    [6] = { "using", 5, TOKEN_KEYWORD_USING },
+    [28] = { "defer", 5, TOKEN_KEYWORD_DEFER },
+    [54] = { "size_of", 7, TOKEN_KEYWORD_SIZE_OF },
+    [48] = { "type_of", 7, TOKEN_KEYWORD_TYPE_OF },
+    [7] = { "initializer_of", 14, TOKEN_KEYWORD_INITIALIZER_OF },
+    [16] = { "type_info", 9, TOKEN_KEYWORD_TYPE_INFO },
+    [39] = { "null", 4, TOKEN_KEYWORD_NULL },
+    [24] = { "enum", 4, TOKEN_KEYWORD_ENUM },
+    [56] = { "true", 4, TOKEN_KEYWORD_TRUE },
+    [38] = { "false", 5, TOKEN_KEYWORD_FALSE },
+    [10] = { "union", 5, TOKEN_KEYWORD_UNION },
+    [19] = { "cast", 4, TOKEN_KEYWORD_CAST },
+    [42] = { "as", 2, TOKEN_KEYWORD_AS },
+};
+
+#define DIRECTIVE_TABLE_BITS 3
+#define DIRECTIVE_TABLE_SEED 1u
+
+static const Keyword_Entry directive_table[1 << DIRECTIVE_TABLE_BITS] = {
+    [7] = { "load", 4, TOKEN_DIRECTIVE_LOAD },
+    [0] = { "import", 6, TOKEN_DIRECTIVE_IMPORT },
+    [1] = { "system_library", 14, TOKEN_DIRECTIVE_SYSTEM_LIBRARY },
+    [2] = { "foreign", 7, TOKEN_DIRECTIVE_FOREIGN },
+};
@@ -7,17 +7,70 @@
 #define DONT_ZERO_TERMINATE 0
 #define USE_STRUCT_PACKING 1
 
-void workspace_setup_llvm(Workspace *w)
+_Thread_local Llvm *llvm_partition = NULL;
+
+inline Llvm *llvm_current(Workspace *w)
+{
+    return llvm_partition ? llvm_partition : &w->llvm;
+}
+
+// Procedures and global variables are declared again in every partition, so there we look up our
+// own copy by the name it has in the workspace module. Nobody changes that module while partitions are built.
+LLVMValueRef llvm_get_global_value(Workspace *w, LLVMValueRef value)
+{
+    Llvm *llvm = llvm_current(w);
+    if (llvm == &w->llvm) return value;
+
+    size_t length;
+    const char *name = LLVMGetValueName2(value, &length);
+
+    LLVMValueRef copy = LLVMIsAFunction(value) ? LLVMGetNamedFunction(llvm->module, name) : LLVMGetNamedGlobal(llvm->module, name);
+    assert(copy && "Should've been declared when the partition was created");
+    return copy;
+}
+
+static LLVMValueRef llvm_get_declaration_value(Workspace *w, const Ast_Declaration *decl)
+{
+    assert(decl->llvm_value);
+    if (!(decl->flags & (DECLARATION_IS_PROCEDURE | DECLARATION_IS_GLOBAL_VARIABLE))) return decl->llvm_value;
+    return llvm_get_global_value(w, decl->llvm_value);
+}
+
+// Sets up the context, module and builder, and creates the types for some of our built-ins.
+void llvm_create_module(Llvm *llvm, const char *name, const char *triple)
 {
-    LLVMInitializeAllTargetInfos();
-    LLVMInitializeAllTargets();
-    LLVMInitializeAllTargetMCs();
-    LLVMInitializeAllAsmParsers();
-    LLVMInitializeAllAsmPrinters();
+    llvm->context = LLVMContextCreate();
+    LLVMContextSetOpaquePointers(llvm->context, 1);
+    // LLVMContextSetDiscardValueNames(llvm->context, 1);
 
-    // Initialize the LLVM target.
+    llvm->module = LLVMModuleCreateWithNameInContext(name, llvm->context);
+    llvm->builder = LLVMCreateBuilderInContext(llvm->context);
 
-    char *triple = LLVMGetDefaultTargetTriple();
+    LLVMSetTarget(llvm->module, triple);
+
+    LLVMTypeRef elems[3];
+
+    elems[0] = LLVMPointerType(LLVMInt8TypeInContext(llvm->context), 0), // *u8
+    elems[1] = LLVMInt64TypeInContext(llvm->context),                    // s64
+    llvm->string_type = LLVMStructTypeInContext(llvm->context, elems, 2, 1); // 1 means packed
+
+    elems[0] = LLVMPointerTypeInContext(llvm->context, 0),
+    elems[1] = LLVMInt64TypeInContext(llvm->context),
+    llvm->slice_type = LLVMStructTypeInContext(llvm->context, elems, 2, 1); // 1 means packed
+
+    elems[0] = LLVMPointerTypeInContext(llvm->context, 0), // data: ptr
+    elems[1] = LLVMInt64TypeInContext(llvm->context),      // count: s64
+    elems[2] = LLVMInt64TypeInContext(llvm->context),      // capacity: s64
+    llvm->dynamic_array_type = LLVMStructTypeInContext(llvm->context, elems, 3, 1); // 1 means packed
+}
+
+// Code generation can change the target machine, so every thread that emits files needs its own.
+// Returns NULL, after saying why, if we can't generate code for the triple.
+LLVMTargetMachineRef llvm_create_target_machine(Workspace *w, const char *triple)
+{
+    static const LLVMCodeGenOptLevel levels[] = { LLVMCodeGenLevelNone, LLVMCodeGenLevelLess, LLVMCodeGenLevelDefault, LLVMCodeGenLevelAggressive };
+    assert(w->optimization_level >= 0 && w->optimization_level <= 3);
+    LLVMCodeGenOptLevel level = levels[w->optimization_level];
 
     char *error_message = NULL;
     LLVMTargetRef target = NULL;
@@ -25,61 +78,99 @@ void workspace_setup_llvm(Workspace *w)
     if (LLVMGetTargetFromTriple(triple, &target, &error_message) != 0) {
         fprintf(stderr, "Error: Could not create LLVM target: %s\n", error_message);
         LLVMDisposeMessage(error_message);
-        LLVMDisposeMessage(triple);
-        return;
+        return NULL;
     }
 
-    printf("%s\n", LLVMGetTargetDescription(target));
+    // For -march=native we ask for whatever this machine has. Features given on top of that can
+    // still turn some of them off, later ones win.
+    const char *cpu = w->target_cpu;
+    const char *features = w->target_features;
+    char *host_cpu = NULL;
+    char *host_features = NULL;
+    if (strcmp(cpu, "native") == 0) {
+        host_cpu = LLVMGetHostCPUName();
+        host_features = LLVMGetHostCPUFeatures();
+        cpu = host_cpu;
+        features = *features ? tprint("%s,%s", host_features, features) : host_features;
+    }
 
     LLVMTargetMachineRef target_machine = LLVMCreateTargetMachine(
         target,                  // T
         triple,                  // Triple
-        "",                      // Cpu
-        "",                      // Features
-        LLVMCodeGenLevelDefault, // Level
+        cpu,                     // Cpu
+        features,                // Features
+        level,                   // Level
         LLVMRelocPIC,            // Reloc
         LLVMCodeModelDefault     // CodeModel
     );
+
+    if (host_cpu) LLVMDisposeMessage(host_cpu);
+    if (host_features) LLVMDisposeMessage(host_features);
+
     if (target_machine == NULL) {
         fprintf(stderr, "Error: Could not create LLVM target machine\n");
-        LLVMDisposeMessage(triple);
-        return;
+        return NULL;
     }
+    return target_machine;
+}
 
-    w->llvm.target_machine = target_machine;
+void workspace_setup_llvm(Workspace *w)
+{
+    // Initialize the LLVM target. Setting up a backend isn't free, so we only set up the one for
+    // this machine, and only if we are asked for some other target all of them.
 
-    // Create the LLVM context.
-    
-    w->llvm.context = LLVMContextCreate();
-    LLVMContextSetOpaquePointers(w->llvm.context, 1);
-    // LLVMContextSetDiscardValueNames(w->llvm.context, 1);
+    LLVMInitializeNativeTarget();
+    LLVMInitializeNativeAsmParser();
+    LLVMInitializeNativeAsmPrinter();
 
-    // Create the LLVM module.
+    char *triple = w->target_triple ? LLVMNormalizeTargetTriple(w->target_triple) : LLVMGetDefaultTargetTriple();
 
-    w->llvm.module = LLVMModuleCreateWithNameInContext(w->name, w->llvm.context);
-    w->llvm.builder = LLVMCreateBuilderInContext(w->llvm.context);
+    LLVMTargetRef target = NULL;
+    char *error_message = NULL;
+    if (LLVMGetTargetFromTriple(triple, &target, &error_message) != 0) {
+        LLVMDisposeMessage(error_message);
+
+        LLVMInitializeAllTargetInfos();
+        LLVMInitializeAllTargets();
+        LLVMInitializeAllTargetMCs();
+        LLVMInitializeAllAsmParsers();
+        LLVMInitializeAllAsmPrinters();
+    }
 
-    LLVMSetTarget(w->llvm.module, triple);
+    LLVMTargetMachineRef target_machine = llvm_create_target_machine(w, triple);
+    if (target_machine == NULL) {
+        LLVMDisposeMessage(triple);
+        exit(1);
+    }
+
+    fprintf(stderr, "%s\n", LLVMGetTargetDescription(LLVMGetTargetMachineTarget(target_machine)));
+
+    w->llvm.target_machine = target_machine;
+
+    llvm_create_module(&w->llvm, w->name, triple);
     LLVMSetModuleDataLayout(w->llvm.module, LLVMCreateTargetDataLayout(target_machine));
 
     LLVMDisposeMessage(triple);
+}
 
-    // Now create the types for some of our built-ins.
-
-    LLVMTypeRef elems[3];
+// Runs LLVM's default pipeline for the optimization level over the whole module. This goes before
+// workspace_save() and workspace_execute_llvm(), so the files we write are optimized too.
+void workspace_optimize_llvm(Workspace *w)
+{
+    if (w->optimization_level == 0) return;
 
-    elems[0] = LLVMPointerType(LLVMInt8TypeInContext(w->llvm.context), 0), // *u8
-    elems[1] = LLVMInt64TypeInContext(w->llvm.context),                    // s64
-    w->llvm.string_type = LLVMStructTypeInContext(w->llvm.context, elems, 2, 1); // 1 means packed
+    const char *pipeline = w->optimize_for_size ? "default<Os>" : tprint("default<O%d>", w->optimization_level);
 
-    elems[0] = LLVMPointerTypeInContext(w->llvm.context, 0),
-    elems[1] = LLVMInt64TypeInContext(w->llvm.context),
-    w->llvm.slice_type = LLVMStructTypeInContext(w->llvm.context, elems, 2, 1); // 1 means packed
+    LLVMPassBuilderOptionsRef options = LLVMCreatePassBuilderOptions();
+    LLVMErrorRef error = LLVMRunPasses(w->llvm.module, pipeline, w->llvm.target_machine, options);
+    LLVMDisposePassBuilderOptions(options);
 
-    elems[0] = LLVMPointerTypeInContext(w->llvm.context, 0), // data: ptr
-    elems[1] = LLVMInt64TypeInContext(w->llvm.context),      // count: s64
-    elems[2] = LLVMInt64TypeInContext(w->llvm.context),      // capacity: s64
-    w->llvm.dynamic_array_type = LLVMStructTypeInContext(w->llvm.context, elems, 3, 1); // 1 means packed
+    if (error) {
+        char *message = LLVMGetErrorMessage(error);
+        fprintf(stderr, "Error: Could not optimize the LLVM module with '%s': %s\n", pipeline, message);
+        LLVMDisposeErrorMessage(message);
+        exit(1);
+    }
 }
 
 void workspace_execute_llvm(Workspace *w)
@@ -88,13 +179,14 @@ void workspace_execute_llvm(Workspace *w)
     For (w->declarations) {
         Ast_Declaration *decl = w->declarations[it];
         if (decl->my_import) {
-            const char *library_path = arena_sv_to_cstr(&temporary_arena, decl->my_import->path_name);
-            decl->my_import->library_data = dlLoadLibrary(library_path);
-            printf("Info: Sucessfully loaded library %p\n", (void*) decl->my_import->library_data);
+            Ast_Import *import = ast_get(decl->my_import);
+            const char *library_path = arena_sv_to_cstr(&temporary_arena, import->path_name);
+            import->library_data = dlLoadLibrary(library_path);
+            fprintf(stderr, "Info: Sucessfully loaded library %p\n", (void*) import->library_data);
         }
     }
     
-    Ast_Declaration *main_decl = find_declaration_in_block(w->global_block, sv_from_cstr("main"));
+    Ast_Declaration *main_decl = find_declaration_in_block(w->global_block, workspace_intern_cstr(w, "main"));
     if (!main_decl) {
         fprintf(stderr, "Error: Cannot run a program with no 'main' entry point.");
         workspace_dispose_llvm(w);
@@ -106,24 +198,16 @@ void workspace_execute_llvm(Workspace *w)
         exit(1);
     }
 
-    Ast_Procedure *proc = xx main_decl->my_value;
+    Ast_Procedure *proc = ast_get(main_decl->my_value);
 
-    if (arrlen(proc->lambda_type->lambda.argument_types) != 0) {
+    if (arrlen(ast_type(proc->lambda_type)->lambda.argument_types) != 0) {
         report_error(w, main_decl->location, "'main' entry point must not take any arguments.");
     }
 
-    // Verify and optimize the module
+    // Verify the module, workspace_optimize_llvm() already optimized it.
     char* error = NULL;
     LLVMVerifyModule(w->llvm.module, LLVMAbortProcessAction, &error);
     LLVMDisposeMessage(error);
-    LLVMPassManagerRef passManager = LLVMCreatePassManager();
-    LLVMAddPromoteMemoryToRegisterPass(passManager);
-    LLVMAddInstructionCombiningPass(passManager);
-    LLVMAddReassociatePass(passManager);
-    LLVMAddGVNPass(passManager);
-    LLVMAddCFGSimplificationPass(passManager);
-    LLVMRunPassManager(passManager, w->llvm.module);
-    LLVMDisposePassManager(passManager);
 
     // Create execution engine
     error = NULL;
@@ -154,15 +238,16 @@ void workspace_dispose_llvm(Workspace *w)
 
 LLVMTypeRef llvm_get_packed_struct_type(Workspace *w, LLVMTypeRef struct_type)
 {
-    LLVMTargetDataRef target_data = LLVMGetModuleDataLayout(w->llvm.module);
+    Llvm *llvm = llvm_current(w);
+    LLVMTargetDataRef target_data = LLVMGetModuleDataLayout(llvm->module);
     const size_t struct_size = LLVMABISizeOfType(target_data, struct_type);
     const size_t num_words = (struct_size + 7) / 8;
-    return LLVMArrayType(LLVMInt64TypeInContext(w->llvm.context), num_words);
+    return LLVMArrayType(LLVMInt64TypeInContext(llvm->context), num_words);
 }
 
 LLVMTypeRef llvm_get_type(Workspace *w, const Ast_Type_Definition *defn)
 {
-    Llvm llvm = w->llvm;
+    Llvm llvm = *llvm_current(w);
     assert(defn);
     // while (defn->_expression.replacement) defn = xx defn->_expression.replacement; // TODO: We should store ** in the typechecker so this goes away.
     switch (defn->kind) {
@@ -185,15 +270,16 @@ LLVMTypeRef llvm_get_type(Workspace *w, const Ast_Type_Definition *defn)
     case TYPE_DEF_STRUCT: {
         // Allocate at least enough for every single declaration in the struct.
         // Not all of the declarations are actually fields, but this is a fast allocator in the temporary buffer so who cares.
-        LLVMTypeRef *field_types = arena_alloc(&temporary_arena, sizeof(LLVMTypeRef) * arrlenu(defn->struct_desc->block->declarations));
+        Ast_Block *block = ast_block(ast_struct(defn->struct_desc)->block);
+        LLVMTypeRef *field_types = arena_alloc(&temporary_arena, sizeof(LLVMTypeRef) * arrlenu(block->declarations));
 
         size_t count = 0;
-        For (defn->struct_desc->block->declarations) {
-            Ast_Declaration *member = defn->struct_desc->block->declarations[it];
+        For (block->declarations) {
+            Ast_Declaration *member = ast_decl(block->declarations[it]);
 
             if (!(member->flags & DECLARATION_IS_STRUCT_FIELD)) continue;
 
-            field_types[count] = llvm_get_type(w, member->my_type);
+            field_types[count] = llvm_get_type(w, ast_type(member->my_type));
             count += 1;
         }
        
@@ -202,12 +288,12 @@ LLVMTypeRef llvm_get_type(Workspace *w, const Ast_Type_Definition *defn)
     case TYPE_DEF_ENUM:
         return LLVMInt32TypeInContext(llvm.context);
     case TYPE_DEF_POINTER:
-        return LLVMPointerType(llvm_get_type(w, defn->pointer_to), 0);
+        return LLVMPointerType(llvm_get_type(w, ast_type(defn->pointer_to)), 0);
     case TYPE_DEF_ARRAY: {
         switch (defn->array.kind) {
         case ARRAY_KIND_FIXED:
             // return LLVMPointerTypeInContext(llvm.context, 0);
-            return LLVMArrayType(llvm_get_type(w, defn->array.element_type), defn->array.length);
+            return LLVMArrayType(llvm_get_type(w, ast_type(defn->array.element_type)), defn->array.length);
         case ARRAY_KIND_SLICE:
             return llvm.slice_type;
         case ARRAY_KIND_DYNAMIC:
@@ -223,13 +309,13 @@ LLVMTypeRef llvm_get_type(Workspace *w, const Ast_Type_Definition *defn)
         size_t arg_count = arrlenu(defn->lambda.argument_types);
         LLVMTypeRef *param_types = arena_alloc(&temporary_arena, sizeof(LLVMTypeRef) * arg_count);
         For (defn->lambda.argument_types) {
-            param_types[it] = llvm_get_type(w, defn->lambda.argument_types[it]);
+            param_types[it] = llvm_get_type(w, ast_type(defn->lambda.argument_types[it]));
 
-            if (defn->lambda.argument_types[it]->kind == TYPE_DEF_STRUCT) {
+            if (ast_type(defn->lambda.argument_types[it])->kind == TYPE_DEF_STRUCT) {
                 param_types[it] = llvm_get_packed_struct_type(w, param_types[it]);
             }
         }
-        LLVMTypeRef return_type = llvm_get_type(w, defn->lambda.return_type);
+        LLVMTypeRef return_type = llvm_get_type(w, ast_type(defn->lambda.return_type));
         return LLVMFunctionType(return_type, param_types, arg_count, defn->lambda.variadic);
     }       
     }
@@ -353,21 +439,22 @@ LLVMValueRef llvm_const_string(Llvm llvm, const char *data, size_t count)
 
 LLVMValueRef llvm_build_pointer(Workspace *w, Ast_Expression *expr)
 {
-    Llvm llvm = w->llvm;
+    Llvm llvm = *llvm_current(w);
     // while (expr->replacement) expr = expr->replacement;
     switch (expr->kind) {
     case AST_IDENT: {
         const Ast_Ident *ident = xx expr;          
-        assert(ident->resolved_declaration);
-        assert(!(ident->resolved_declaration->flags & DECLARATION_IS_CONSTANT)); // It should have been substituted.
-        assert(!(ident->resolved_declaration->flags & DECLARATION_IS_FOR_LOOP_ITERATOR)); // Should have thrown an error that you can't assign to this.
-        assert(ident->resolved_declaration->llvm_value); // Must have been initialized.
-        return ident->resolved_declaration->llvm_value;
+        Ast_Declaration *decl = ast_decl(ident->resolved_declaration);
+        assert(decl);
+        assert(!(decl->flags & DECLARATION_IS_CONSTANT)); // It should have been substituted.
+        assert(!(decl->flags & DECLARATION_IS_FOR_LOOP_ITERATOR)); // Should have thrown an error that you can't assign to this.
+        assert(decl->llvm_value); // Must have been initialized.
+        return llvm_get_declaration_value(w, decl);
     }
     case AST_SELECTOR: {
         const Ast_Selector *selector = xx expr;
-        LLVMTypeRef struct_type = llvm_get_type(w, selector->namespace_expression->inferred_type);
-        LLVMValueRef struct_pointer = llvm_build_pointer(w, selector->namespace_expression);
+        LLVMTypeRef struct_type = llvm_get_type(w, ast_type_of(selector->namespace_expression));
+        LLVMValueRef struct_pointer = llvm_build_pointer(w, ast_expr(selector->namespace_expression));
 
         assert(selector->struct_field_index >= 0);
 
@@ -382,8 +469,8 @@ LLVMValueRef llvm_build_pointer(Workspace *w, Ast_Expression *expr)
         Ast_Unary_Operator *unary = xx expr;
 
         if (unary->operator_type == TOKEN_POINTER_DEREFERENCE) {
-            LLVMTypeRef type = llvm_get_type(w, unary->subexpression->inferred_type);
-            LLVMValueRef pointer = llvm_build_pointer(w, unary->subexpression);
+            LLVMTypeRef type = llvm_get_type(w, ast_type_of(unary->subexpression));
+            LLVMValueRef pointer = llvm_build_pointer(w, ast_expr(unary->subexpression));
                 
             // @Speed: This is all just for debugging.
             String_View pointer_name;
@@ -397,10 +484,10 @@ LLVMValueRef llvm_build_pointer(Workspace *w, Ast_Expression *expr)
         Ast_Binary_Operator *binary = xx expr;
 
         if (binary->operator_type == TOKEN_ARRAY_SUBSCRIPT) {
-            LLVMValueRef array_pointer = llvm_build_pointer(w, binary->left);
-            LLVMValueRef index = llvm_build_expression(w, binary->right);
+            LLVMValueRef array_pointer = llvm_build_pointer(w, ast_expr(binary->left));
+            LLVMValueRef index = llvm_build_expression(w, ast_expr(binary->right));
 
-            if (binary->left->inferred_type->array.kind != ARRAY_KIND_FIXED) {
+            if (ast_type_of(binary->left)->array.kind != ARRAY_KIND_FIXED) {
                 // @Speed: This is all just for debugging.
                 String_View array_name;
                 array_name.data = LLVMGetValueName2(array_pointer, &array_name.count);
@@ -418,7 +505,7 @@ LLVMValueRef llvm_build_pointer(Workspace *w, Ast_Expression *expr)
         }
 
         // Must be pointer arithmetics.
-        assert(binary->left->inferred_type->kind == TYPE_DEF_POINTER);
+        assert(ast_type_of(binary->left)->kind == TYPE_DEF_POINTER);
 
         UNIMPLEMENTED;
 
@@ -436,7 +523,7 @@ LLVMValueRef llvm_build_pointer(Workspace *w, Ast_Expression *expr)
     default:
         break;
     }
-    if (expr->inferred_type->kind != TYPE_DEF_POINTER) {
+    if (ast_type(expr->inferred_type)->kind != TYPE_DEF_POINTER) {
         report_error(w, expr->location, "We encountered something that we tried to use as a pointer that wasn't a pointer (this is an internal errro).");
     }
     return llvm_build_expression(w, expr);
@@ -499,19 +586,19 @@ LLVMOpcode llvm_get_cast_opcode(Workspace *w, Ast_Type_Definition *from, Ast_Typ
 
 LLVMValueRef llvm_build_expression(Workspace *w, Ast_Expression *expr)
 {
-    Llvm llvm = w->llvm;
+    Llvm llvm = *llvm_current(w);
     // while (expr->replacement) expr = expr->replacement;
     switch (expr->kind) {
     case AST_NUMBER: {
         const Ast_Number *number = xx expr;
-        LLVMTypeRef type = llvm_get_type(w, expr->inferred_type);
-        assert(expr->inferred_type->kind == TYPE_DEF_NUMBER);
-        if (expr->inferred_type->number.flags & NUMBER_FLAGS_FLOAT) return LLVMConstReal(type, number->as.real);
+        LLVMTypeRef type = llvm_get_type(w, ast_type(expr->inferred_type));
+        assert(ast_type(expr->inferred_type)->kind == TYPE_DEF_NUMBER);
+        if (ast_type(expr->inferred_type)->number.flags & NUMBER_FLAGS_FLOAT) return LLVMConstReal(type, number->as.real);
         return LLVMConstInt(type, number->as.integer, 1);
     }
     case AST_LITERAL: {
         const Ast_Literal *lit = xx expr;           
-        LLVMTypeRef type = llvm_get_type(w, expr->inferred_type);
+        LLVMTypeRef type = llvm_get_type(w, ast_type(expr->inferred_type));
         switch (lit->kind) {
         case LITERAL_BOOL: return LLVMConstInt(LLVMInt1TypeInContext(llvm.context), lit->bool_value, 0);
         case LITERAL_NULL: return LLVMConstNull(type);
@@ -519,7 +606,7 @@ LLVMValueRef llvm_build_expression(Workspace *w, Ast_Expression *expr)
         case LITERAL_STRING: {
             LLVMValueRef string_data_pointer = llvm_const_string(llvm, lit->string_value.data, lit->string_value.count);
                     
-            if (expr->inferred_type == w->type_def_string) {
+            if (ast_type(expr->inferred_type) == w->type_def_string) {
                 // Create constant structure value.
                 LLVMValueRef struct_fields[] = {
                     string_data_pointer,
@@ -537,25 +624,26 @@ LLVMValueRef llvm_build_expression(Workspace *w, Ast_Expression *expr)
     }
     case AST_IDENT: {
         const Ast_Ident *ident = xx expr;
-        assert(ident->resolved_declaration);
+        Ast_Declaration *decl = ast_decl(ident->resolved_declaration);
+        assert(decl);
 
-        if (ident->resolved_declaration->flags & DECLARATION_IS_PROCEDURE) {
-            return ident->resolved_declaration->llvm_value;
+        if (decl->flags & DECLARATION_IS_PROCEDURE) {
+            return llvm_get_declaration_value(w, decl);
         }
 
-        assert(!(ident->resolved_declaration->flags & DECLARATION_IS_CONSTANT)); // It should have been substituted.
+        assert(!(decl->flags & DECLARATION_IS_CONSTANT)); // It should have been substituted.
 
         // Because during typechecking we assured that the variable's initialization came before us, this is safe.
-        assert(ident->resolved_declaration->llvm_value);
+        assert(decl->llvm_value);
 
-        if (ident->resolved_declaration->flags & DECLARATION_IS_FOR_LOOP_ITERATOR) {
-            return ident->resolved_declaration->llvm_value;
+        if (decl->flags & DECLARATION_IS_FOR_LOOP_ITERATOR) {
+            return decl->llvm_value;
         }
 
         return LLVMBuildLoad2(
             llvm.builder,
-            llvm_get_type(w, ident->_expression.inferred_type),
-            ident->resolved_declaration->llvm_value,
+            llvm_get_type(w, ast_type(ident->_expression.inferred_type)),
+            llvm_get_declaration_value(w, decl),
             "");
     }
     case AST_UNARY_OPERATOR: {
@@ -563,15 +651,15 @@ LLVMValueRef llvm_build_expression(Workspace *w, Ast_Expression *expr)
 
         switch (unary->operator_type) {
         case '!': {
-            LLVMValueRef value = llvm_build_expression(w, unary->subexpression);
+            LLVMValueRef value = llvm_build_expression(w, ast_expr(unary->subexpression));
             if (!value) return NULL;
             return LLVMBuildNot(llvm.builder, value, "");
         }
         case '*':
-            return llvm_build_pointer(w, unary->subexpression);
+            return llvm_build_pointer(w, ast_expr(unary->subexpression));
         case TOKEN_POINTER_DEREFERENCE: {
-            LLVMTypeRef type = llvm_get_type(w, expr->inferred_type);
-            LLVMValueRef pointer = llvm_build_expression(w, unary->subexpression);
+            LLVMTypeRef type = llvm_get_type(w, ast_type(expr->inferred_type));
+            LLVMValueRef pointer = llvm_build_expression(w, ast_expr(unary->subexpression));
             if (!pointer) return NULL;
 
             // @Speed: This is all just for debugging.
@@ -589,25 +677,25 @@ LLVMValueRef llvm_build_expression(Workspace *w, Ast_Expression *expr)
         const Ast_Binary_Operator *binary = xx expr;
 
         if (binary->operator_type == TOKEN_ARRAY_SUBSCRIPT) {
-            return LLVMBuildLoad2(llvm.builder, llvm_get_type(w, expr->inferred_type), llvm_build_pointer(w, expr), "");
+            return LLVMBuildLoad2(llvm.builder, llvm_get_type(w, ast_type(expr->inferred_type)), llvm_build_pointer(w, expr), "");
         }
 
-        LLVMValueRef LHS = llvm_build_expression(w, binary->left);
-        LLVMValueRef RHS = llvm_build_expression(w, binary->right);
+        LLVMValueRef LHS = llvm_build_expression(w, ast_expr(binary->left));
+        LLVMValueRef RHS = llvm_build_expression(w, ast_expr(binary->right));
 
         LLVMIntPredicate int_predicate;
         LLVMRealPredicate real_predicate;
-        LLVMOpcode opcode = llvm_get_opcode(binary->operator_type, binary->left->inferred_type, &int_predicate, &real_predicate);
+        LLVMOpcode opcode = llvm_get_opcode(binary->operator_type, ast_type_of(binary->left), &int_predicate, &real_predicate);
 
         // Comparison operators.
         if (opcode == LLVMICmp) return LLVMBuildICmp(llvm.builder, int_predicate, LHS, RHS, "");
         if (opcode == LLVMFCmp) return LLVMBuildFCmp(llvm.builder, real_predicate, LHS, RHS, "");
 
         // @Hack for pointer arithmetic in LLVM.
-        if (binary->left->inferred_type->kind == TYPE_DEF_POINTER && binary->right->inferred_type->kind == TYPE_DEF_NUMBER) {
+        if (ast_type_of(binary->left)->kind == TYPE_DEF_POINTER && ast_type_of(binary->right)->kind == TYPE_DEF_NUMBER) {
             LHS = LLVMBuildPtrToInt(llvm.builder, LHS, LLVMTypeOf(RHS), "");
             LLVMValueRef result = LLVMBuildBinOp(llvm.builder, opcode, LHS, RHS, "");
-            return LLVMBuildIntToPtr(llvm.builder, result, llvm_get_type(w, binary->left->inferred_type), "");
+            return LLVMBuildIntToPtr(llvm.builder, result, llvm_get_type(w, ast_type_of(binary->left)), "");
         }
             
         return LLVMBuildBinOp(llvm.builder, opcode, LHS, RHS, "");
@@ -616,23 +704,23 @@ LLVMValueRef llvm_build_expression(Workspace *w, Ast_Expression *expr)
         const Ast_Procedure *proc = xx expr;
         LLVMValueRef procedure = proc->llvm_value;
         assert(procedure); // These get created in a pre-pass.
-        return procedure;
+        return llvm_get_global_value(w, procedure);
     }
     case AST_PROCEDURE_CALL: {
         const Ast_Procedure_Call *call = xx expr;
-        LLVMValueRef procedure = llvm_build_expression(w, call->procedure_expression);
-        LLVMTypeRef procedure_type = llvm_get_type(w, call->procedure_expression->inferred_type);
+        LLVMValueRef procedure = llvm_build_expression(w, ast_expr(call->procedure_expression));
+        LLVMTypeRef procedure_type = llvm_get_type(w, ast_type_of(call->procedure_expression));
 
         size_t args_count = arrlenu(call->arguments);
         LLVMValueRef *args = arena_alloc(&temporary_arena, sizeof(LLVMValueRef) * args_count);
 
         For (call->arguments) {
-            Ast_Expression *arg = call->arguments[it];
+            Ast_Expression *arg = ast_expr(call->arguments[it]);
 
-            if (arg->inferred_type->kind == TYPE_DEF_STRUCT) {
+            if (ast_type(arg->inferred_type)->kind == TYPE_DEF_STRUCT) {
                 if (arg->kind == AST_TYPE_INSTANTIATION) {
                     // If we are constant, we must copy ourselves into a temporary value and then use that pointer.
-                    args[it] = LLVMBuildAlloca(llvm.builder, llvm_get_type(w, arg->inferred_type), "temp");
+                    args[it] = LLVMBuildAlloca(llvm.builder, llvm_get_type(w, ast_type(arg->inferred_type)), "temp");
                     LLVMBuildStore(llvm.builder, llvm_build_expression(w, arg), args[it]);
                 } else {
                     args[it] = llvm_build_pointer(w, arg);
@@ -640,7 +728,7 @@ LLVMValueRef llvm_build_expression(Workspace *w, Ast_Expression *expr)
                     
                 args[it] = LLVMBuildLoad2(
                     llvm.builder,
-                    llvm_get_packed_struct_type(w, llvm_get_type(w, arg->inferred_type)),
+                    llvm_get_packed_struct_type(w, llvm_get_type(w, ast_type(arg->inferred_type))),
                     args[it],
                     "");
             } else {
@@ -657,24 +745,24 @@ LLVMValueRef llvm_build_expression(Workspace *w, Ast_Expression *expr)
         report_error(w, expr->location, "Types cannot be used as values in our LLVM implementation yet.");
     case AST_CAST: {
         const Ast_Cast *cast = xx expr;
-        assert(cast->type->size >= 0);
-        assert(cast->subexpression->inferred_type->size >= 0);
+        assert(ast_type(cast->type)->size >= 0);
+        assert(ast_type_of(cast->subexpression)->size >= 0);
 
-        LLVMTypeRef dest_type = llvm_get_type(w, cast->type);
-        LLVMValueRef value = llvm_build_expression(w, cast->subexpression);
+        LLVMTypeRef dest_type = llvm_get_type(w, ast_type(cast->type));
+        LLVMValueRef value = llvm_build_expression(w, ast_expr(cast->subexpression));
 
         LLVMOpcode opcode;
 
         if (cast->value_cast) {
-            opcode = llvm_get_cast_opcode(w, cast->subexpression->inferred_type, cast->type);
+            opcode = llvm_get_cast_opcode(w, ast_type_of(cast->subexpression), ast_type(cast->type));
             return LLVMBuildCast(llvm.builder, opcode, value, dest_type, "cast");
         }
 
-        if (cast->type->size > cast->subexpression->inferred_type->size) {
+        if (ast_type(cast->type)->size > ast_type_of(cast->subexpression)->size) {
             // For now, we always do a zero-extending cast (this seems closest to bitcast).
             // Sign extension cast will probably be a separate instruction or a modifier on the "as" keyword.
             opcode = LLVMZExt;
-        } else if (cast->type->size < cast->subexpression->inferred_type->size) {
+        } else if (ast_type(cast->type)->size < ast_type_of(cast->subexpression)->size) {
             opcode = LLVMTrunc;
         } else {
             opcode = LLVMBitCast;
@@ -686,7 +774,7 @@ LLVMValueRef llvm_build_expression(Workspace *w, Ast_Expression *expr)
         const Ast_Selector *selector = xx expr;
             
         if (selector->struct_field_index >= 0) {
-            LLVMTypeRef field_type = llvm_get_type(w, selector->_expression.inferred_type);
+            LLVMTypeRef field_type = llvm_get_type(w, ast_type(selector->_expression.inferred_type));
             LLVMValueRef field_pointer = llvm_build_pointer(w, expr);
             return LLVMBuildLoad2(llvm.builder, field_type, field_pointer, "");
         }
@@ -696,14 +784,14 @@ LLVMValueRef llvm_build_expression(Workspace *w, Ast_Expression *expr)
     case AST_TYPE_INSTANTIATION: {
         const Ast_Type_Instantiation *inst = xx expr;
 
-        assert(inst->type_definition->kind != TYPE_DEF_LITERAL); // Typechecking should replace this.
+        assert(ast_type(inst->type_definition)->kind != TYPE_DEF_LITERAL); // Typechecking should replace this.
 
         size_t n = arrlenu(inst->arguments);
 
         LLVMValueRef *values = arena_alloc(&temporary_arena, n * sizeof(LLVMValueRef));
         For (inst->arguments) {
             // printf(">> %s\n", expr_to_string(inst->arguments[it]));
-            values[it] = llvm_build_expression(w, inst->arguments[it]);
+            values[it] = llvm_build_expression(w, ast_expr(inst->arguments[it]));
         }
         return LLVMConstStructInContext(llvm.context, values, n, USE_STRUCT_PACKING);
     }
@@ -712,33 +800,33 @@ LLVMValueRef llvm_build_expression(Workspace *w, Ast_Expression *expr)
 
 void llvm_build_statement(Workspace *w, LLVMValueRef function, Ast_Statement *stmt)
 {
-    Llvm llvm = w->llvm;
+    Llvm llvm = *llvm_current(w);
     switch (stmt->kind) {
     case AST_BLOCK: {
         const Ast_Block *block = xx stmt;
         // LLVMBasicBlockRef basic_block = LLVMAppendBasicBlock(function, "");
         // LLVMPositionBuilderAtEnd(llvm.builder, basic_block);
         For (block->statements) {
-            llvm_build_statement(w, function, block->statements[it]);
+            llvm_build_statement(w, function, ast_stmt(block->statements[it]));
         }
         break;
     }
     case AST_WHILE: {
         const Ast_While *while_stmt = xx stmt;
             
-        LLVMBasicBlockRef basic_block_loop = LLVMAppendBasicBlock(function, "loop");
+        LLVMBasicBlockRef basic_block_loop = LLVMAppendBasicBlockInContext(llvm.context, function, "loop");
         LLVMBuildBr(llvm.builder, basic_block_loop); // Implicit break from current block to the loop.
         LLVMPositionBuilderAtEnd(llvm.builder, basic_block_loop);
 
-        LLVMBasicBlockRef basic_block_then = LLVMAppendBasicBlock(function, "then");
-        LLVMBasicBlockRef basic_block_merge = LLVMAppendBasicBlock(function, "merge");
+        LLVMBasicBlockRef basic_block_then = LLVMAppendBasicBlockInContext(llvm.context, function, "then");
+        LLVMBasicBlockRef basic_block_merge = LLVMAppendBasicBlockInContext(llvm.context, function, "merge");
 
-        LLVMValueRef condition = llvm_build_expression(w, while_stmt->condition_expression);
+        LLVMValueRef condition = llvm_build_expression(w, ast_expr(while_stmt->condition_expression));
         LLVMBuildCondBr(llvm.builder, condition, basic_block_then, basic_block_merge);
 
         // Emit the "then" statement.
         LLVMPositionBuilderAtEnd(llvm.builder, basic_block_then);
-        llvm_build_statement(w, function, while_stmt->then_statement);
+        llvm_build_statement(w, function, ast_stmt(while_stmt->then_statement));
         LLVMBuildBr(llvm.builder, basic_block_loop);
         // LLVMBuildCondBr(llvm.builder, condition, basic_block_loop, basic_block_merge);
             
@@ -748,24 +836,24 @@ void llvm_build_statement(Workspace *w, LLVMValueRef function, Ast_Statement *st
     }
     case AST_IF: {
         const Ast_If *if_stmt = xx stmt;
-        LLVMValueRef condition = llvm_build_expression(w, if_stmt->condition_expression);
+        LLVMValueRef condition = llvm_build_expression(w, ast_expr(if_stmt->condition_expression));
 
-        LLVMBasicBlockRef basic_block_then = LLVMAppendBasicBlock(function, "then");
+        LLVMBasicBlockRef basic_block_then = LLVMAppendBasicBlockInContext(llvm.context, function, "then");
         LLVMBasicBlockRef basic_block_else, basic_block_merge;
 
         // Emit the conditional break.
         if (if_stmt->else_statement) {
-            basic_block_else = LLVMAppendBasicBlock(function, "else");
+            basic_block_else = LLVMAppendBasicBlockInContext(llvm.context, function, "else");
             LLVMBuildCondBr(llvm.builder, condition, basic_block_then, basic_block_else);
-            basic_block_merge = LLVMAppendBasicBlock(function, "merge");
+            basic_block_merge = LLVMAppendBasicBlockInContext(llvm.context, function, "merge");
         } else {
-            basic_block_merge = LLVMAppendBasicBlock(function, "merge");
+            basic_block_merge = LLVMAppendBasicBlockInContext(llvm.context, function, "merge");
             LLVMBuildCondBr(llvm.builder, condition, basic_block_then, basic_block_merge);
         }
         
         // Emit the "then" statement.
         LLVMPositionBuilderAtEnd(llvm.builder, basic_block_then);
-        llvm_build_statement(w, function, if_stmt->then_statement);
+        llvm_build_statement(w, function, ast_stmt(if_stmt->then_statement));
         if (LLVMGetBasicBlockTerminator(basic_block_then) == NULL) {
             LLVMBuildBr(llvm.builder, basic_block_merge);
         }
@@ -773,7 +861,7 @@ void llvm_build_statement(Workspace *w, LLVMValueRef function, Ast_Statement *st
         // Emit the "else" statement.
         if (if_stmt->else_statement) {
             LLVMPositionBuilderAtEnd(llvm.builder, basic_block_else);
-            llvm_build_statement(w, function, if_stmt->else_statement);
+            llvm_build_statement(w, function, ast_stmt(if_stmt->else_statement));
             if (LLVMGetBasicBlockTerminator(basic_block_else) == NULL) {
                 LLVMBuildBr(llvm.builder, basic_block_merge);
             }
@@ -789,7 +877,7 @@ void llvm_build_statement(Workspace *w, LLVMValueRef function, Ast_Statement *st
         LLVMBasicBlockRef basic_block_current = LLVMGetLastBasicBlock(function);
 
         // Add the loop block.
-        LLVMBasicBlockRef basic_block_loop = LLVMAppendBasicBlock(function, "loop");
+        LLVMBasicBlockRef basic_block_loop = LLVMAppendBasicBlockInContext(llvm.context, function, "loop");
         LLVMBuildBr(llvm.builder, basic_block_loop); // Implicit break from current block to the loop.
         LLVMPositionBuilderAtEnd(llvm.builder, basic_block_loop);
 
@@ -800,23 +888,23 @@ void llvm_build_statement(Workspace *w, LLVMValueRef function, Ast_Statement *st
 
         LLVMAddIncoming(it_phi, &zero, &basic_block_current, 1);
 
-        for_stmt->iterator_declaration->llvm_value = it_phi;
+        ast_decl(for_stmt->iterator_declaration)->llvm_value = it_phi;
 
         // Temporary assert until we have iterators over arrays.
-        assert(for_stmt->range_expression->kind == AST_BINARY_OPERATOR);
-        const Ast_Binary_Operator *binary = xx for_stmt->range_expression;
+        assert(ast_expr(for_stmt->range_expression)->kind == AST_BINARY_OPERATOR);
+        const Ast_Binary_Operator *binary = ast_get(for_stmt->range_expression);
         assert(binary->operator_type == TOKEN_DOUBLE_DOT);
 
         // Add the loop body & the exit condition.
-        LLVMBasicBlockRef basic_block_then = LLVMAppendBasicBlock(function, "then");
-        LLVMBasicBlockRef basic_block_merge = LLVMAppendBasicBlock(function, "merge");       
+        LLVMBasicBlockRef basic_block_then = LLVMAppendBasicBlockInContext(llvm.context, function, "then");
+        LLVMBasicBlockRef basic_block_merge = LLVMAppendBasicBlockInContext(llvm.context, function, "merge");       
 
-        LLVMValueRef cond = LLVMBuildICmp(llvm.builder, LLVMIntSLE, it_phi, llvm_build_expression(w, binary->right), "");
+        LLVMValueRef cond = LLVMBuildICmp(llvm.builder, LLVMIntSLE, it_phi, llvm_build_expression(w, ast_expr(binary->right)), "");
         LLVMBuildCondBr(llvm.builder, cond, basic_block_then, basic_block_merge);
 
         // Emit code for the then block.
         LLVMPositionBuilderAtEnd(llvm.builder, basic_block_then);
-        llvm_build_statement(w, function, for_stmt->then_statement);
+        llvm_build_statement(w, function, ast_stmt(for_stmt->then_statement));
         LLVMValueRef it_incr = LLVMBuildAdd(llvm.builder, it_phi, LLVMConstInt(i64, 1, 0), "it_incr");
         LLVMAddIncoming(it_phi, &it_incr, &basic_block_then, 1);
         LLVMBuildBr(llvm.builder, basic_block_loop);
@@ -830,36 +918,37 @@ void llvm_build_statement(Workspace *w, LLVMValueRef function, Ast_Statement *st
     }
     case AST_RETURN: {
         const Ast_Return *ret = xx stmt;
-        LLVMValueRef value = llvm_build_expression(w, ret->subexpression);
+        LLVMValueRef value = llvm_build_expression(w, ast_expr(ret->subexpression));
         LLVMBuildRet(llvm.builder, value);
         break;
     }
     case AST_VARIABLE: {
         Ast_Variable *var = xx stmt;
-        const char *name = var->declaration->ident->name.data;
+        Ast_Declaration *decl = ast_decl(var->declaration);
+        const char *name = ast_ident(decl->ident)->name->name.data;
 
-        LLVMValueRef alloca = LLVMBuildAlloca(llvm.builder, llvm_get_type(w, var->declaration->my_type), name);
-        var->declaration->llvm_value = alloca;
+        LLVMValueRef alloca = LLVMBuildAlloca(llvm.builder, llvm_get_type(w, ast_type(decl->my_type)), name);
+        decl->llvm_value = alloca;
        
-        if (var->declaration->flags & DECLARATION_IS_LAMBDA_ARGUMENT) {
+        if (decl->flags & DECLARATION_IS_LAMBDA_ARGUMENT) {
             LLVMBuildStore(llvm.builder, LLVMGetParam(function, var->lambda_argument_index), alloca);
             break;
         }
 
-        LLVMValueRef initializer = llvm_build_expression(w, var->declaration->my_value);
+        LLVMValueRef initializer = llvm_build_expression(w, ast_expr(decl->my_value));
         LLVMBuildStore(llvm.builder, initializer, alloca);
         break;
     }
     case AST_ASSIGNMENT: {
         Ast_Assignment *assign = xx stmt;
-        LLVMValueRef pointer = llvm_build_pointer(w, assign->pointer);
-        LLVMValueRef value = llvm_build_expression(w, assign->value);
+        LLVMValueRef pointer = llvm_build_pointer(w, ast_expr(assign->pointer));
+        LLVMValueRef value = llvm_build_expression(w, ast_expr(assign->value));
         LLVMBuildStore(llvm.builder, value, pointer);
         break;
     }
     case AST_EXPRESSION_STATEMENT: {
         Ast_Expression_Statement *x = xx stmt;
-        llvm_build_expression(w, x->subexpression);
+        llvm_build_expression(w, ast_expr(x->subexpression));
         break;
     }
     default:
@@ -1,36 +1,192 @@
 #include <errno.h>
 #include <string.h> // strerror
-#include <stdlib.h> // exit
+#include <stdlib.h> // exit, strtol
+#include <limits.h> // INT_MAX
 
 #include "parser.h"
 #include "workspace.h"
 #include "typecheck.h"
 
-Arena temporary_arena = {0};
+_Thread_local Arena thread_temporary_arena = {0};
 Arena general_arena = {0};
-Arena *context_arena = &general_arena;
+_Thread_local Arena *thread_context_arena = NULL; // Set in main(), see common.h.
+
+// Parses the comma separated list of --emit.
+static unsigned int parse_outputs(const char *flag, String_View list)
+{
+    unsigned int outputs = 0;
+    while (list.count) {
+        String_View kind = sv_chop_by_delim(&list, ',');
+        if (sv_eq(kind, SV("bc"))) {
+            outputs |= OUTPUT_BITCODE;
+        } else if (sv_eq(kind, SV("ir")) || sv_eq(kind, SV("llvm"))) {
+            outputs |= OUTPUT_IR;
+        } else if (sv_eq(kind, SV("asm"))) {
+            outputs |= OUTPUT_ASSEMBLY;
+        } else if (sv_eq(kind, SV("obj"))) {
+            outputs |= OUTPUT_OBJECT;
+        } else {
+            fprintf(stderr, "Error: Unknown output '"SV_Fmt"' for '%s', expected some of bc,ir,asm,obj.\n", SV_Arg(kind), flag);
+            exit(1);
+        }
+    }
+    return outputs;
+}
+
+static const char *shift_flag_value(const char *flag, int *argc, char ***argv)
+{
+    if (!*argc) {
+        fprintf(stderr, "Error: '%s' expects a value.\n", flag);
+        exit(1);
+    }
+    return shift_args(argc, argv);
+}
+
+static void print_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [options] [input_file | -]\n", program);
+    fprintf(stderr, "    --check                  Stop after typechecking.\n");
+    fprintf(stderr, "    --emit=bc,ir,asm,obj     Write these files next to the input.\n");
+    fprintf(stderr, "    --run                    Run 'main' in the JIT.\n");
+    fprintf(stderr, "    -O0 .. -O3, -Os          How hard LLVM should optimize, before anything is emitted (default -O2).\n");
+    fprintf(stderr, "    --no-verify              Don't verify every procedure after building its LLVM IR.\n");
+    fprintf(stderr, "    --target TRIPLE          Build for this target instead of this machine.\n");
+    fprintf(stderr, "    --cpu NAME, -march=NAME  Build for this CPU, 'native' is the one in this machine.\n");
+    fprintf(stderr, "    --features LIST          Turn CPU features on or off, like +avx2,-fma.\n");
+    fprintf(stderr, "    --llvm-partitions N      Build the LLVM IR in N modules on separate threads.\n");
+    fprintf(stderr, "    --pretokenize            Lex each file completely before parsing it.\n");
+    fprintf(stderr, "    --lazy-bodies            Only typecheck and build the procedures that are used, the others only get parsed.\n");
+    fprintf(stderr, "    --timings                Print how long lexing and parsing took.\n");
+    fprintf(stderr, "Without --check, --emit or --run, we emit ir,asm,obj and then run.\n");
+}
 
 int main(int argc, char **argv)
 {   
+    context_arena = &general_arena;
+
     const char *program = shift_args(&argc, &argv);
 
+    bool pretokenize = false;
+    bool lazy_bodies = false;
+    bool print_timings = false;
+    int llvm_partition_count = 1;
+    int optimization_level = 2;
+    bool optimize_for_size = false;
+    bool verify_llvm = true;
+    const char *target_triple = NULL;
+    const char *target_cpu = "";
+    const char *target_features = "";
+
+    // What the driver does after parsing.
+    bool check_only = false;
+    bool run = false;
+    bool emit = false;
+    unsigned int outputs = OUTPUT_IR | OUTPUT_ASSEMBLY | OUTPUT_OBJECT;
+
+    while (argc && argv[0][0] == '-' && argv[0][1] != '\0') { // A lone '-' is stdin.
+        const char *flag = shift_args(&argc, &argv);
+        if (strcmp(flag, "--pretokenize") == 0) {
+            pretokenize = true;
+        } else if (strcmp(flag, "--lazy-bodies") == 0) {
+            lazy_bodies = true;
+        } else if (strcmp(flag, "--timings") == 0) {
+            print_timings = true;
+        } else if (strcmp(flag, "--llvm-partitions") == 0) {
+            const char *value = shift_flag_value(flag, &argc, &argv);
+            char *end;
+            long count = strtol(value, &end, 10);
+            if (end == value || *end != '\0' || count < 1 || count > INT_MAX) {
+                fprintf(stderr, "Error: '%s' expects a number of partitions of at least 1, but got '%s'.\n", flag, value);
+                exit(1);
+            }
+            llvm_partition_count = (int) count;
+        } else if (strcmp(flag, "--check") == 0) {
+            check_only = true;
+        } else if (strcmp(flag, "--run") == 0) {
+            run = true;
+        } else if (strcmp(flag, "--emit") == 0) {
+            emit = true;
+            outputs = parse_outputs(flag, sv_from_cstr(shift_flag_value(flag, &argc, &argv)));
+        } else if (strncmp(flag, "--emit=", 7) == 0) {
+            emit = true;
+            outputs = parse_outputs("--emit", sv_from_cstr(flag + 7));
+        } else if (flag[1] == 'O' && flag[2] >= '0' && flag[2] <= '3' && flag[3] == '\0') {
+            optimization_level = flag[2] - '0';
+            optimize_for_size = false;
+        } else if (strcmp(flag, "-Os") == 0) {
+            optimization_level = 2;
+            optimize_for_size = true;
+        } else if (strcmp(flag, "--no-verify") == 0) {
+            verify_llvm = false;
+        } else if (strcmp(flag, "--target") == 0) {
+            target_triple = shift_flag_value(flag, &argc, &argv);
+        } else if (strcmp(flag, "--cpu") == 0) {
+            target_cpu = shift_flag_value(flag, &argc, &argv);
+        } else if (strcmp(flag, "--features") == 0) {
+            target_features = shift_flag_value(flag, &argc, &argv);
+        } else if (strncmp(flag, "-march=", 7) == 0) {
+            target_cpu = flag + 7;
+        } else if (strcmp(flag, "--help") == 0) {
+            print_usage(program);
+            exit(0);
+        } else {
+            fprintf(stderr, "Error: Unknown flag '%s'.\n", flag);
+            exit(1);
+        }
+    }
+
     if (!argc) {
-        fprintf(stderr, "Usage: %s [input_file]\n", program);
+        print_usage(program);
         fprintf(stderr, "... expected at least one input file\n");
         exit(1);
     }
 
+    if (check_only && (emit || run)) {
+        fprintf(stderr, "Error: '--check' stops after typechecking, so it can't be used with '%s'.\n", emit ? "--emit" : "--run");
+        exit(1);
+    }
+
+    // Nothing asked for means everything, like it has always been.
+    if (!check_only && !emit && !run) {
+        emit = true;
+        run = true;
+    }
+
     const char *input_path = shift_args(&argc, &argv);
 
     Workspace w0;
     workspace_init(&w0, "My Program");
+    w0.pretokenize = pretokenize;
+    w0.lazy_bodies = lazy_bodies;
+    w0.llvm_partition_count = llvm_partition_count;
+    w0.optimization_level = optimization_level;
+    w0.optimize_for_size = optimize_for_size;
+    w0.verify_llvm = verify_llvm;
+    w0.target_triple = target_triple;
+    w0.target_cpu = target_cpu;
+    w0.target_features = target_features;
+    w0.outputs = emit ? outputs : 0;
     workspace_add_file(&w0, input_path);
+
+    if (print_timings) {
+        if (w0.timings.token_count) { // Big files are always lexed up front.
+            printf("Lexing:  %.3f ms (%zu tokens)\n", w0.timings.lex_seconds * 1000.0, w0.timings.token_count);
+        }
+        printf("Parsing: %.3f ms\n", w0.timings.parse_seconds * 1000.0);
+        printf("Wall:    %.3f ms\n", w0.timings.parse_wall_seconds * 1000.0);
+    }
     workspace_typecheck(&w0);
-    workspace_setup_llvm(&w0);
-    workspace_llvm(&w0);
-    workspace_save(&w0);
-    workspace_execute_llvm(&w0);
-    workspace_dispose_llvm(&w0);
+
+    if (!check_only) {
+        workspace_setup_llvm(&w0);
+        workspace_llvm(&w0);
+        workspace_optimize_llvm(&w0);
+        if (w0.outputs) workspace_save(&w0);
+        if (run) workspace_execute_llvm(&w0);
+        workspace_dispose_llvm(&w0);
+    }
+
+    For (w0.files) source_file_free(&w0.files[it]);
 
     arena_free(&temporary_arena);
     return 0;
@@ -1,26 +1,644 @@
+#define _DEFAULT_SOURCE // mkstemps
 #define NOBUILD_IMPLEMENTATION
 #include "vendor/nobuild.h"
 
+#include <stdbool.h>
+
+#include "hash.h"
+
 #define WARNINGS "-Wall", "-Wextra", "-Wpedantic", "-Wfatal-errors"
 #define CFLAGS WARNINGS, "-std=c11", "-g"
-#define LIBS "-lm", "-lLLVM-15", "-ldynload_s"
+#define LIBS "-lm", "-lpthread", "-lLLVM-15", "-ldynload_s"
 
 // TODO: All files in directory "src"
-#define SOURCE "token.c", "parser.c", "workspace.c", "typecheck.c", "llvm.c"
+#define SOURCE "token.c", "parser.c", "workspace.c", "typecheck.c", "llvm.c", "thread_pool.c"
+
+typedef struct {
+    const char *name;
+    const char *token_type;
+} Keyword;
+
+static const Keyword keywords[] = {
+    { "if",             "TOKEN_KEYWORD_IF" },
+    { "then",           "TOKEN_KEYWORD_THEN" },
+    { "else",           "TOKEN_KEYWORD_ELSE" },
+    { "for",            "TOKEN_KEYWORD_FOR" },
+    { "return",         "TOKEN_KEYWORD_RETURN" },
+    { "struct",         "TOKEN_KEYWORD_STRUCT" },
+    { "while",          "TOKEN_KEYWORD_WHILE" },
+    { "break",          "TOKEN_KEYWORD_BREAK" },
+    { "continue",       "TOKEN_KEYWORD_CONTINUE" },
+    { "using",          "TOKEN_KEYWORD_USING" },
+    { "defer",          "TOKEN_KEYWORD_DEFER" },
+    { "size_of",        "TOKEN_KEYWORD_SIZE_OF" },
+    { "type_of",        "TOKEN_KEYWORD_TYPE_OF" },
+    { "initializer_of", "TOKEN_KEYWORD_INITIALIZER_OF" },
+    { "type_info",      "TOKEN_KEYWORD_TYPE_INFO" },
+    { "null",           "TOKEN_KEYWORD_NULL" },
+    { "enum",           "TOKEN_KEYWORD_ENUM" },
+    { "true",           "TOKEN_KEYWORD_TRUE" },
+    { "false",          "TOKEN_KEYWORD_FALSE" },
+    { "union",          "TOKEN_KEYWORD_UNION" },
+    { "cast",           "TOKEN_KEYWORD_CAST" },
+    { "as",             "TOKEN_KEYWORD_AS" },
+};
+
+// These are matched without the leading '#'.
+static const Keyword directives[] = {
+    { "load",           "TOKEN_DIRECTIVE_LOAD" },
+    { "import",         "TOKEN_DIRECTIVE_IMPORT" },
+    { "system_library", "TOKEN_DIRECTIVE_SYSTEM_LIBRARY" },
+    { "foreign",        "TOKEN_DIRECTIVE_FOREIGN" },
+};
+
+#define ARRAY_COUNT(xs) (sizeof(xs) / sizeof((xs)[0]))
+#define MAX_TABLE_BITS 12
+
+// Finds the smallest table, and then the first odd multiplier, for which every keyword lands in its own slot.
+static void find_perfect_hash(const Keyword *keys, size_t count, int *out_bits, uint32_t *out_seed)
+{
+    static bool used[1 << MAX_TABLE_BITS];
+
+    int bits = 1;
+    while ((1u << bits) < 2*count) bits += 1;
+
+    for (; bits <= MAX_TABLE_BITS; bits++) {
+        for (uint32_t seed = 1; seed < 1000000; seed += 2) {
+            memset(used, 0, sizeof(used));
+
+            size_t i = 0;
+            for (; i < count; i++) {
+                uint32_t hash = hash_identifier(keys[i].name, strlen(keys[i].name));
+                uint32_t slot = hash_to_slot(hash, seed, bits);
+                if (used[slot]) break;
+                used[slot] = true;
+            }
+
+            if (i == count) {
+                *out_bits = bits;
+                *out_seed = seed;
+                return;
+            }
+        }
+    }
+
+    PANIC("Could not find a perfect hash for %zu keywords", count);
+}
+
+static void write_table(FILE *f, const char *name, const char *macro_prefix, const Keyword *keys, size_t count)
+{
+    int bits;
+    uint32_t seed;
+    find_perfect_hash(keys, count, &bits, &seed);
+
+    fprintf(f, "#define %s_TABLE_BITS %d\n", macro_prefix, bits);
+    fprintf(f, "#define %s_TABLE_SEED %uu\n\n", macro_prefix, seed);
+    fprintf(f, "static const Keyword_Entry %s_table[1 << %s_TABLE_BITS] = {\n", name, macro_prefix);
+    for (size_t i = 0; i < count; i++) {
+        size_t length = strlen(keys[i].name);
+        uint32_t slot = hash_to_slot(hash_identifier(keys[i].name, length), seed, bits);
+        fprintf(f, "    [%u] = { \"%s\", %zu, %s },\n", slot, keys[i].name, length, keys[i].token_type);
+    }
+    fprintf(f, "};\n");
+}
+
+static void generate_keyword_table(const char *output_path)
+{
+    INFO("GENERATE: %s", output_path);
+
+    FILE *f = fopen(output_path, "w");
+    if (!f) PANIC("Could not open %s: %s", output_path, strerror(errno));
+
+    fprintf(f, "// Generated by nobuild.c, do not edit. Change the keyword lists in there instead.\n");
+    fprintf(f, "// Included by token.c, which defines Keyword_Entry.\n\n");
+    fprintf(f, "#pragma once\n\n");
+    write_table(f, "keyword", "KEYWORD", keywords, ARRAY_COUNT(keywords));
+    fprintf(f, "\n");
+    write_table(f, "directive", "DIRECTIVE", directives, ARRAY_COUNT(directives));
+
+    fclose(f);
+}
+
+// Just enough of a bignum to build the power-of-five table below. Little-endian 32-bit limbs.
+#define BIG_LIMBS 64
+
+typedef struct {
+    uint32_t limbs[BIG_LIMBS];
+} Big;
+
+static int big_bit_length(const Big *a)
+{
+    for (int i = BIG_LIMBS - 1; i >= 0; i--) {
+        if (a->limbs[i]) {
+            int bits = 0;
+            for (uint32_t x = a->limbs[i]; x; x >>= 1) bits += 1;
+            return i*32 + bits;
+        }
+    }
+    return 0;
+}
+
+static void big_mul_small(Big *a, uint32_t m)
+{
+    uint64_t carry = 0;
+    for (int i = 0; i < BIG_LIMBS; i++) {
+        uint64_t x = (uint64_t)a->limbs[i] * m + carry;
+        a->limbs[i] = (uint32_t)x;
+        carry = x >> 32;
+    }
+    if (carry) PANIC("Bignum overflow");
+}
+
+static void big_shift_left_one(Big *a, bool in)
+{
+    if (a->limbs[BIG_LIMBS - 1] >> 31) PANIC("Bignum overflow");
+    for (int i = BIG_LIMBS - 1; i > 0; i--) a->limbs[i] = (a->limbs[i] << 1) | (a->limbs[i - 1] >> 31);
+    a->limbs[0] = (a->limbs[0] << 1) | (uint32_t)in;
+}
+
+static void big_shift_right_one(Big *a)
+{
+    for (int i = 0; i < BIG_LIMBS - 1; i++) a->limbs[i] = (a->limbs[i] >> 1) | (a->limbs[i + 1] << 31);
+    a->limbs[BIG_LIMBS - 1] >>= 1;
+}
+
+static int big_compare(const Big *a, const Big *b)
+{
+    for (int i = BIG_LIMBS - 1; i >= 0; i--) {
+        if (a->limbs[i] != b->limbs[i]) return a->limbs[i] < b->limbs[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+static void big_subtract(Big *a, const Big *b)
+{
+    uint64_t borrow = 0;
+    for (int i = 0; i < BIG_LIMBS; i++) {
+        uint64_t x = (uint64_t)a->limbs[i] - b->limbs[i] - borrow;
+        a->limbs[i] = (uint32_t)x;
+        borrow = (x >> 63) & 1;
+    }
+}
+
+static void big_add_one(Big *a)
+{
+    for (int i = 0; i < BIG_LIMBS && ++a->limbs[i] == 0; i++) {}
+}
+
+// quotient = 2^power / divisor, by plain binary long division.
+static void big_divide_power_of_two(int power, const Big *divisor, Big *quotient)
+{
+    Big remainder = {0};
+    *quotient = (Big){0};
+    for (int bit = power; bit >= 0; bit--) {
+        big_shift_left_one(&remainder, bit == power);
+        big_shift_left_one(quotient, false);
+        if (big_compare(&remainder, divisor) >= 0) {
+            big_subtract(&remainder, divisor);
+            quotient->limbs[0] |= 1;
+        }
+    }
+}
+
+static uint64_t big_u64_at(const Big *a, int limb)
+{
+    return ((uint64_t)a->limbs[limb + 1] << 32) | a->limbs[limb];
+}
+
+#define SMALLEST_POWER_OF_FIVE -342
+#define LARGEST_POWER_OF_FIVE 308
+
+// The 128 most significant bits of 5^q, as used by the Eisel-Lemire algorithm. For negative q this
+// is a reciprocal rounded up, so that the truncated product never underestimates.
+static void generate_power_of_five_table(const char *output_path)
+{
+    INFO("GENERATE: %s", output_path);
+
+    FILE *f = fopen(output_path, "w");
+    if (!f) PANIC("Could not open %s: %s", output_path, strerror(errno));
+
+    fprintf(f, "// Generated by nobuild.c, do not edit.\n");
+    fprintf(f, "// Included by token.c for parsing float literals.\n\n");
+    fprintf(f, "#pragma once\n\n");
+    fprintf(f, "#define SMALLEST_POWER_OF_FIVE (%d)\n", SMALLEST_POWER_OF_FIVE);
+    fprintf(f, "#define LARGEST_POWER_OF_FIVE %d\n\n", LARGEST_POWER_OF_FIVE);
+    fprintf(f, "// Pairs of (high, low) 64-bit halves, starting at 5^SMALLEST_POWER_OF_FIVE.\n");
+    fprintf(f, "static const uint64_t power_of_five_128[2*(LARGEST_POWER_OF_FIVE - SMALLEST_POWER_OF_FIVE + 1)] = {\n");
+
+    for (int q = SMALLEST_POWER_OF_FIVE; q <= LARGEST_POWER_OF_FIVE; q++) {
+        Big power = {0};
+        power.limbs[0] = 1;
+        for (int i = 0; i < (q < 0 ? -q : q); i++) big_mul_small(&power, 5);
+
+        Big result;
+        if (q < 0) {
+            int z = big_bit_length(&power); // 5^-q is never a power of two, so 2^(z-1) < 5^-q < 2^z.
+            int b = (q >= -27) ? z + 127 : 2*z + 128;
+            big_divide_power_of_two(b, &power, &result);
+            big_add_one(&result);
+        } else {
+            result = power;
+            while (big_bit_length(&result) < 128) big_shift_left_one(&result, false);
+        }
+        while (big_bit_length(&result) > 128) big_shift_right_one(&result);
+
+        fprintf(f, "    0x%016llxull, 0x%016llxull, // 5^%d\n",
+            (unsigned long long)big_u64_at(&result, 2), (unsigned long long)big_u64_at(&result, 0), q);
+    }
+
+    fprintf(f, "};\n");
+    fclose(f);
+}
+
+// TESTS
+//
+// Every program in tests/ and examples/ says in comments what it is supposed to do:
+//     // Output: <line>   It runs and prints exactly these lines, in this order.
+//     // Error: <text>    Compiling it fails, and the diagnostics contain this text.
+//     // Skip: <reason>   It doesn't work yet.
+// Programs that say none of these (examples that need libraries we don't have) only get typechecked.
+// The others go through every one of test_configs, since those all take their own path to the same result.
+
+#ifndef _WIN32
+
+#include <unistd.h> // mkstemp, unlink
+#include <sys/wait.h>
+
+typedef struct {
+    const char *name;
+    const char *command; // Run by the shell, %s is the path of the program.
+} Test_Config;
+
+static const Test_Config test_configs[] = {
+    { "default", "./main --run %s" },
+    { "lazy bodies", "./main --run --lazy-bodies %s" },
+    { "pretokenize", "./main --run --pretokenize %s" },
+    { "stdin", "cat %s | ./main --run -" }, // A pipe, so it is streamed into the lexer while it is read.
+    { "llvm partitions", "./main --run --llvm-partitions 3 %s" },
+};
+
+typedef struct {
+    char *data;
+    size_t count;
+} Text;
+
+static void text_append(Text *text, const char *data, size_t count)
+{
+    text->data = realloc(text->data, text->count + count + 1);
+    memcpy(text->data + text->count, data, count);
+    text->count += count;
+    text->data[text->count] = '\0';
+}
+
+static Text text_read(FILE *f)
+{
+    Text text = {0};
+    text_append(&text, "", 0);
+
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) text_append(&text, buffer, n);
+    return text;
+}
+
+static Text text_read_file(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) PANIC("Could not open %s: %s", path, strerror(errno));
+    Text text = text_read(f);
+    fclose(f);
+    return text;
+}
+
+typedef struct {
+    bool skip;
+    bool check_only;
+    Text output; // Every line ends in a newline.
+    Cstr_Array errors;
+} Test_Expectation;
+
+// Returns what follows the comment if the line is one, or NULL.
+static const char *test_comment(const char *line, size_t length, const char *marker)
+{
+    while (length > 0 && (*line == ' ' || *line == '\t')) line++, length--;
+
+    size_t n = strlen(marker);
+    if (length < n || memcmp(line, marker, n) != 0) return NULL;
+    line += n;
+    if (*line == ' ') line++;
+    return line;
+}
+
+static Test_Expectation read_test_expectation(const char *path)
+{
+    Test_Expectation e = {0};
+    text_append(&e.output, "", 0);
+    bool expects_something = false;
+
+    Text source = text_read_file(path);
+    for (char *line = source.data; line < source.data + source.count;) {
+        char *end = strchr(line, '\n');
+        if (!end) end = source.data + source.count;
+        size_t length = end - line;
+        if (length > 0 && line[length - 1] == '\r') length--;
+        line[length] = '\0';
+
+        const char *rest;
+        if ((rest = test_comment(line, length, "// Output:"))) {
+            text_append(&e.output, rest, strlen(rest));
+            text_append(&e.output, "\n", 1);
+            expects_something = true;
+        } else if ((rest = test_comment(line, length, "// Error:"))) {
+            e.errors = cstr_array_append(e.errors, strdup(rest));
+            expects_something = true;
+        } else if (test_comment(line, length, "// Skip:")) {
+            e.skip = true;
+        }
+
+        line = end + 1;
+    }
+    free(source.data);
+
+    e.check_only = !expects_something;
+    return e;
+}
+
+// Runs the command with the shell, stdout and stderr end up in out and err. Returns the exit code, or -1 if it crashed.
+static int run_captured(const char *command, Text *out, Text *err)
+{
+    char err_path[] = "/tmp/nobuild-test-XXXXXX";
+    int fd = mkstemp(err_path);
+    if (fd < 0) PANIC("Could not make a temporary file: %s", strerror(errno));
+    close(fd);
+
+    Cstr full = CONCAT(command, " 2>", err_path);
+    FILE *pipe = popen(full, "r");
+    if (!pipe) PANIC("Could not run %s: %s", full, strerror(errno));
+    *out = text_read(pipe);
+    int status = pclose(pipe);
+
+    *err = text_read_file(err_path);
+    unlink(err_path);
+
+    if (status < 0 || !WIFEXITED(status)) return -1;
+    return WEXITSTATUS(status);
+}
+
+static bool run_test(const char *path, const char *config_name, const char *command_format, const Test_Expectation *e)
+{
+    char command[4096];
+    snprintf(command, sizeof(command), command_format, path);
+
+    Text out, err;
+    int exit_code = run_captured(command, &out, &err);
+
+    bool passed;
+    if (e->check_only) {
+        passed = exit_code == 0;
+    } else if (e->errors.count > 0) {
+        passed = exit_code > 0;
+        for (size_t i = 0; i < e->errors.count; i++) {
+            if (!strstr(err.data, e->errors.elems[i])) passed = false;
+        }
+    } else {
+        passed = exit_code == 0 && out.count == e->output.count && memcmp(out.data, e->output.data, out.count) == 0;
+    }
+
+    if (passed) {
+        INFO("PASS: %s (%s)", path, config_name);
+    } else {
+        ERRO("FAIL: %s (%s), exit code %d: %s", path, config_name, exit_code, command);
+        if (e->errors.count == 0 && !e->check_only) fprintf(stderr, "Expected output:\n%s", e->output.data);
+        fprintf(stderr, "Output:\n%s", out.data);
+        fprintf(stderr, "Diagnostics:\n%s", err.data);
+    }
+
+    free(out.data);
+    free(err.data);
+    return passed;
+}
+
+static int compare_cstrs(const void *a, const void *b)
+{
+    return strcmp(*(Cstr *)a, *(Cstr *)b);
+}
+
+static bool run_tests_in(const char *directory, int *failures)
+{
+    // Collect the names first, running things in the loop would leave errno set for it.
+    Cstr_Array paths = {0};
+    FOREACH_FILE_IN_DIR(file, directory, {
+        if (ENDS_WITH(file, ".ax")) paths = cstr_array_append(paths, PATH(directory, file));
+    });
+    qsort(paths.elems, paths.count, sizeof(*paths.elems), compare_cstrs);
+
+    for (size_t p = 0; p < paths.count; p++) {
+        Cstr path = paths.elems[p];
+        Test_Expectation e = read_test_expectation(path);
+        if (e.skip) {
+            INFO("SKIP: %s", path);
+        } else if (e.check_only) {
+            if (!run_test(path, "check", "./main --check %s", &e)) *failures += 1;
+        } else {
+            for (size_t i = 0; i < ARRAY_COUNT(test_configs); i++) {
+                if (!run_test(path, test_configs[i].name, test_configs[i].command, &e)) *failures += 1;
+            }
+        }
+    }
+    return paths.count > 0;
+}
+
+// Generated tests use xorshift64, so they are the same every time.
+static uint64_t test_random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void float_test_digits(char *buffer, size_t *n, size_t count, uint64_t *state)
+{
+    for (size_t i = 0; i < count; i++) buffer[(*n)++] = '0' + test_random(state) % 10;
+}
+
+// Float literals don't go through strtod() in the compiler (see parse_float_value() in token.c),
+// so this writes a program that prints the bits of many of them, and expects what strtod() says.
+static void write_float_literal_test(FILE *f, Test_Expectation *e)
+{
+    static const char *const fixed[] = {
+        "0.0", "1.0", "0.1", "0.5", "3.141592653589793", "123456.789",
+        "9007199254740992.0", "9007199254740993.0", "9007199254740995.0", // 2^53, and halfway below and above 2^53+2.
+        "4503599627370496.5", "4503599627370497.5", // Halfway, with even and odd below.
+        "0.30000000000000004", "0.1000000000000000055511151231257827021181583404541015625",
+        "179769313486231570814527423731704356798070567525844996598917476803157260780028538760589558632766878171540458953514382464234321326889464182768467546703537516986049910576551282076245490090389328944075868508455133942304583236903222948165808559332123348274797826204144723168738177180919299881250404026184124858368.0",
+        "1797693134862315708145274237317043567980705675258449965989174768031572607800285387605895586327668781715404589535143824642343213268894641827684675467035375169860499105765512820762454900903893289440758685084551339423045832369032229481658085593321233482747978262041447231687381771809192998812504040261841248583680.0",
+        "0.000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000022250738585072014",
+        "0.000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000004940656458412465",
+        "0.000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000002470328229206232720882",
+        "12345678901234567890123456789012345678901234567890.0",
+        "0.00000000000000000000000000000000000000001234567890123456789012345678901234567890",
+    };
+
+    fprintf(f, "#load \"modules/libc.ax\";\n\nmain :: () {\n    x: float64;\n    bits := (*x) as *u64;\n");
+
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    char literal[1024];
+    for (size_t i = 0; i < ARRAY_COUNT(fixed) + 300; i++) {
+        if (i < ARRAY_COUNT(fixed)) {
+            snprintf(literal, sizeof(literal), "%s", fixed[i]);
+        } else {
+            // Short ones take the exact fast path, long or far out ones the slower paths.
+            size_t n = 0;
+            size_t leading_zeros = (i % 3 == 0) ? test_random(&state) % 330 : 0;
+            size_t whole = (leading_zeros > 0) ? 0 : 1 + test_random(&state) % 40;
+            size_t fraction = 1 + test_random(&state) % 30;
+
+            if (whole == 0) {
+                literal[n++] = '0';
+            } else {
+                literal[n++] = '1' + test_random(&state) % 9;
+                float_test_digits(literal, &n, whole - 1, &state);
+            }
+            literal[n++] = '.';
+            for (size_t z = 0; z < leading_zeros; z++) literal[n++] = '0';
+            float_test_digits(literal, &n, fraction, &state);
+            literal[n] = '\0';
+        }
+
+        double value = strtod(literal, NULL);
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+
+        fprintf(f, "    x = %s;\n    printf(\"%%016llx\\n\", bits.*);\n", literal);
+
+        char line[32];
+        snprintf(line, sizeof(line), "%016llx\n", (unsigned long long)bits);
+        text_append(&e->output, line, strlen(line));
+    }
+
+    fprintf(f, "}\n");
+}
+
+// Big enough to be lexed in pieces (see PARALLEL_LEX_CHUNK_SIZE in workspace.c), if there is more than
+// one processor to lex them on. Every constant uses one that comes after it, so typechecking keeps
+// waiting for declarations it hasn't got to yet.
+#define BIG_TEST_CONSTANT_COUNT 140000
+#define BIG_TEST_PROCEDURE_EVERY 250
+
+static void write_big_program_test(FILE *f, Test_Expectation *e)
+{
+    static size_t uses[BIG_TEST_CONSTANT_COUNT];
+    static long long values[BIG_TEST_CONSTANT_COUNT];
+
+    uint64_t state = 0x2545F4914F6CDD1Dull;
+    for (size_t i = BIG_TEST_CONSTANT_COUNT; i-- > 0;) {
+        uses[i] = i + 1 + test_random(&state) % 1000;
+        values[i] = i % 10;
+        if (uses[i] < BIG_TEST_CONSTANT_COUNT) values[i] += values[uses[i]];
+    }
+
+    fprintf(f, "#load \"modules/libc.ax\";\n\nmain :: () {\n");
+    for (size_t i = 0; i < BIG_TEST_CONSTANT_COUNT; i += 10*BIG_TEST_PROCEDURE_EVERY) {
+        fprintf(f, "    printf(\"%%d\\n\", f%zu(1));\n", i);
+
+        // s.a + s.b is 3*(x + K), and g adds x + i % 7.
+        long long result = 3*(1 + values[i]) + 1 + i % 7;
+        char line[32];
+        snprintf(line, sizeof(line), "%lld\n", result);
+        text_append(&e->output, line, strlen(line));
+    }
+    fprintf(f, "}\n\n");
+
+    for (size_t i = 0; i < BIG_TEST_CONSTANT_COUNT; i++) {
+        if (uses[i] < BIG_TEST_CONSTANT_COUNT) fprintf(f, "K%zu :: K%zu + %zu;\n", i, uses[i], i % 10);
+        else fprintf(f, "K%zu :: %zu;\n", i, i % 10);
+
+        if (i % BIG_TEST_PROCEDURE_EVERY == 0) {
+            fprintf(f, "f%zu :: (x: int) -> int { s: S%zu; s.a = x + K%zu; s.b = s.a * 2; return s.a + s.b + g%zu(x); }\n", i, i, i, i);
+            fprintf(f, "S%zu :: struct { a: int; b: int; }\n", i);
+            fprintf(f, "g%zu :: (x: int) -> int { return x + %zu; }\n", i, i % 7);
+            fprintf(f, "unused%zu :: () -> int { return f%zu(2); }\n", i, i);
+        }
+    }
+}
+
+// Writes a program with write() into a temporary file, and runs it like the ones in tests/.
+static void run_generated_test(const char *name, void (*write)(FILE *f, Test_Expectation *e), int *failures)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "/tmp/nobuild-%s-XXXXXX.ax", name);
+    int fd = mkstemps(path, 3);
+    if (fd < 0) PANIC("Could not make a temporary file: %s", strerror(errno));
+    FILE *f = fdopen(fd, "w");
+
+    Test_Expectation e = {0};
+    text_append(&e.output, "", 0);
+    write(f, &e);
+    fclose(f);
+
+    for (size_t i = 0; i < ARRAY_COUNT(test_configs); i++) {
+        if (!run_test(path, test_configs[i].name, test_configs[i].command, &e)) *failures += 1;
+    }
+
+    unlink(path);
+    free(e.output.data);
+}
+
+static bool run_tests(void)
+{
+    int failures = 0;
+    if (!run_tests_in("tests", &failures)) PANIC("Found no tests in tests/");
+    run_generated_test("float-literals", write_float_literal_test, &failures);
+    run_generated_test("big-program", write_big_program_test, &failures);
+    run_tests_in("examples", &failures);
+
+    if (failures) {
+        ERRO("%d test runs failed", failures);
+        return false;
+    }
+    INFO("All tests passed");
+    return true;
+}
+
+#else
+
+static bool run_tests(void)
+{
+    PANIC("The tests need a POSIX shell, they don't run on Windows yet");
+    return false;
+}
+
+#endif // _WIN32
 
 int main(int argc, char **argv)
 {
     GO_REBUILD_URSELF(argc, argv);
 
+    const char *program = shift_args(&argc, &argv);
+    bool test = false;
+    while (argc > 0) {
+        const char *arg = shift_args(&argc, &argv);
+        if (strcmp(arg, "test") == 0) test = true;
+        else PANIC("Usage: %s [test]", program);
+    }
+
+    generate_keyword_table("keywords.h");
+    generate_power_of_five_table("float_tables.h");
+
     const char *main_path = "main.c";
 
     CMD("clang", CFLAGS, "-o", NOEXT(main_path), main_path, SOURCE, LIBS);
 
+    // Front-end throughput benchmark, see bench.c. Optimized, since that is what we want to measure.
+    CMD("clang", CFLAGS, "-O2", "-o", "bench", "bench.c", SOURCE, LIBS);
+
     // FOREACH_FILE_IN_DIR(tool, "src", {
     //     if (ENDS_WITH(tool, ".c")) {
     //         build_tool(tool);
     //     }
     // });
 
+    if (test) return run_tests() ? 0 : 1;
     return 0;
 }
@@ -1,63 +1,142 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS, MAP_NORESERVE
 #include <assert.h>
 #include <errno.h>
 #include <string.h> // strerror
 #include <stdio.h> // os_read_entire_file
 
+#ifndef _WIN32
+#    include <sys/mman.h>
+#else
+#    include "windows.h"
+#endif // _WIN32
+
 #include "common.h"
 #include "parser.h"
 #include "workspace.h"
 
 // printf("%s:%d: >>> %p.\n", __FILE__, __LINE__, (void*)the_block);
 
-#define Enter_Block(parser, the_block) do {        \
-    (the_block)->parent = (parser)->current_block; \
-    (parser)->current_block = (the_block);         \
+#define Enter_Block(parser, the_block) do {                    \
+    (the_block)->parent = ast_handle((parser)->current_block); \
+    (parser)->current_block = (the_block);                     \
 } while (0);
 
-#define Exit_Block(parser, the_block) do {                     \
-    assert((parser)->current_block == the_block);              \
-    (parser)->current_block = (parser)->current_block->parent; \
+#define Exit_Block(parser, the_block) do {                               \
+    assert((parser)->current_block == the_block);                        \
+    (parser)->current_block = ast_block((parser)->current_block->parent); \
 } while (0);
 
+char *ast_pool_memory;
+static _Atomic uint32_t ast_pool_counts[AST_POOL_COUNT]; // Files are parsed on several threads, and they all allocate here.
+#ifdef _WIN32
+static size_t ast_pool_committed[AST_POOL_COUNT]; // In bytes.
+#define AST_POOL_COMMIT_STEP ((size_t)1 << 20)
+#endif
+
+void ast_pools_init(void)
+{
+    if (ast_pool_memory) return;
+
+    size_t size = AST_POOL_COUNT * AST_POOL_RESERVE;
+#ifndef _WIN32
+    // MAP_NORESERVE: Pages only get memory once a node is put in them.
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED) memory = NULL;
+#else
+    void *memory = VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS); // Committed as the pools grow, see ast_pool_alloc().
+#endif
+    if (!memory) {
+        fprintf(stderr, "Error: Could not reserve %zu bytes of address space for the syntax tree.\n", size);
+        exit(1);
+    }
+    ast_pool_memory = memory;
+}
+
+void ast_pools_reset(void)
+{
+    // The pages are kept for the next nodes, that is the point of running it again and again.
+    for (unsigned int pool = 1; pool < AST_POOL_COUNT; pool++) {
+        char *base = ast_pool_memory + ((size_t)pool << AST_POOL_RESERVE_BITS);
+        memset(base, 0, (size_t)ast_pool_counts[pool] * ast_node_sizes[pool]);
+        ast_pool_counts[pool] = 0;
+    }
+}
+
+size_t ast_pools_bytes_used(void)
+{
+    size_t result = 0;
+    for (unsigned int pool = 1; pool < AST_POOL_COUNT; pool++) {
+        result += (size_t)ast_pool_counts[pool] * ast_node_sizes[pool];
+    }
+    return result;
+}
+
+uint32_t ast_pool_count(unsigned int pool)
+{
+    return ast_pool_counts[pool];
+}
+
+void *ast_pool_alloc(unsigned int pool)
+{
+    assert(pool > 0 && pool < AST_POOL_COUNT && ast_node_sizes[pool]);
+
+    // A handle's index has AST_HANDLE_INDEX_BITS, and the nodes have to fit into the reservation.
+    size_t capacity = AST_POOL_RESERVE / ast_node_sizes[pool];
+    if (capacity > ((size_t)1 << AST_HANDLE_INDEX_BITS)) capacity = (size_t)1 << AST_HANDLE_INDEX_BITS;
+
+    uint32_t index = ast_pool_counts[pool]++;
+    if (index >= capacity) {
+        fprintf(stderr, "Error: The program has more than %zu syntax tree nodes of one kind, which is more than we can hold.\n", capacity);
+        exit(1);
+    }
+
+    char *node = ast_get(ast_pool_handle(pool, index));
+#ifdef _WIN32
+    // There are no worker threads on Windows yet (see thread_pool.h), so nobody commits at the same time.
+    size_t end = (size_t)(index + 1) * ast_node_sizes[pool];
+    if (end > ast_pool_committed[pool]) {
+        char *base = ast_pool_memory + ((size_t)pool << AST_POOL_RESERVE_BITS);
+        size_t committed = (end + AST_POOL_COMMIT_STEP - 1) & ~(AST_POOL_COMMIT_STEP - 1);
+        if (!VirtualAlloc(base, committed, MEM_COMMIT, PAGE_READWRITE)) {
+            fprintf(stderr, "Error: Out of memory for the syntax tree.\n");
+            exit(1);
+        }
+        ast_pool_committed[pool] = committed;
+    }
+#endif
+    return node;
+}
+
 static inline Ast_Ident *make_identifier(Parser *p, Token token)
 {
-    // We copy the name but append a '\0' so it can be a c-string for LLVM.
-    Ast_Ident *ident = ast_alloc(p, token.location, AST_IDENT, sizeof(*ident));
-    ident->name.data = arena_sv_to_cstr(context_arena, token.string_value);
-    ident->name.count = token.string_value.count;
-    ident->enclosing_block = p->current_block;
+    Ast_Ident *ident = ast_alloc(token.location, AST_IDENT);
+    ident->name = workspace_intern(p->workspace, token.string_value, token.identifier_hash);
+    ident->enclosing_block = ast_handle(p->current_block);
     return ident;
 }
 
 static inline Ast_Declaration *make_declaration(Parser *p, Source_Location loc)
 {
-    Ast_Declaration *decl = arena_alloc(p->arena, sizeof(*decl));
+    Ast_Declaration *decl = ast_pool_alloc(AST_POOL_DECLARATION);
     decl->location = loc;
     decl->serial = p->serial;
     p->serial += 1;
-    arrput(p->workspace->declarations, decl);
+    arrput(p->declarations, decl);
     return decl;
 }
 
 static inline Ast_Type_Definition *make_type_definition(Parser *p, Source_Location loc, Type_Def_Kind kind)
 {
-    Ast_Type_Definition *defn = ast_alloc(p, loc, AST_TYPE_DEFINITION, sizeof(*defn));
+    Ast_Type_Definition *defn = ast_alloc(loc, AST_TYPE_DEFINITION);
     defn->kind = kind;
     defn->size = -1;
     // defn->_expression.inferred_type = p->workspace->type_def_type;
     return defn;
 }
 
-static Source_Location location_info_begin_end(Source_Location begin, Source_Location end)
+static inline Source_Location location_info_begin_end(Source_Location begin, Source_Location end)
 {
-    assert(begin.fid == end.fid);
-    Source_Location loc;
-    loc.fid = begin.fid;
-    loc.c0 = begin.c0;
-    loc.l0 = begin.l0;
-    loc.c1 = end.c1;
-    loc.l1 = end.l1;
-    return loc;
+    return source_location_span(begin, end);
 }
 
 static int operator_precedence_from_token_type(int type)
@@ -133,14 +212,14 @@ static bool expression_requires_semicolon(Ast_Expression *expr)
     }
     if (expr->kind == AST_PROCEDURE) {
         Ast_Procedure *proc = xx expr;
-        return proc->foreign_library_name != NULL;
+        return proc->foreign_library_name != 0;
     }
     return true;
 }
 
 static bool declaration_requires_semicolon(Ast_Declaration *decl)
 {
-    if (decl->my_value) return expression_requires_semicolon(decl->my_value);
+    if (decl->my_value) return expression_requires_semicolon(ast_expr(decl->my_value));
     // Not sure when this can happen...
     return true;
 }
@@ -151,16 +230,16 @@ static bool statement_requires_semicolon(Ast_Statement *stmt)
     case AST_BLOCK: return false;
     case AST_WHILE: {
         Ast_While *while_stmt = xx stmt;
-        return statement_requires_semicolon(while_stmt->then_statement);
+        return statement_requires_semicolon(ast_stmt(while_stmt->then_statement));
     }
     case AST_IF: {
         Ast_If *if_stmt = xx stmt;
-        if (if_stmt->else_statement) return statement_requires_semicolon(if_stmt->else_statement);
-        return statement_requires_semicolon(if_stmt->then_statement);
+        if (if_stmt->else_statement) return statement_requires_semicolon(ast_stmt(if_stmt->else_statement));
+        return statement_requires_semicolon(ast_stmt(if_stmt->then_statement));
     }
     case AST_FOR: {
         Ast_For *for_stmt = xx stmt;
-        return statement_requires_semicolon(for_stmt->then_statement);
+        return statement_requires_semicolon(ast_stmt(for_stmt->then_statement));
     }
     case AST_LOOP_CONTROL:
     case AST_RETURN:
@@ -169,68 +248,146 @@ static bool statement_requires_semicolon(Ast_Statement *stmt)
         return true;
     case AST_EXPRESSION_STATEMENT: {
         Ast_Expression_Statement *expr = xx stmt;
-        return expression_requires_semicolon(expr->subexpression);
+        return expression_requires_semicolon(ast_expr(expr->subexpression));
     }
     case AST_VARIABLE: return true;
     case AST_ASSIGNMENT: return true;
     }
 }
 
-inline void *ast_alloc(Parser *p, Source_Location loc, unsigned int type, size_t size)
+void *ast_alloc(Source_Location loc, unsigned int kind)
 {
-    Ast_Expression *ast = arena_alloc(p->arena, size);
-    memset(ast, 0, size); // TODO: We could only memset the part AFTER Ast_Expression, but what about Ast_Statement...?
-    ast->kind = type;
+    assert(kind > 0 && kind < AST_POOL_DECLARATION);
+    Ast_Expression *ast = ast_pool_alloc(kind); // Already zeroed.
+    ast->kind = kind;
     ast->location = loc;
     return ast;
 }
 
-Ast_Expression *parse_binary_expression(Parser *p, Ast_Expression *left, int precedence)
+// A '(' that starts a parenthesized expression, as opposed to a lambda's argument list.
+// @Volatile: Must agree with the '(' case in parse_base_expression().
+static bool at_open_parenthesis(Parser *p)
 {
-    if (left == NULL) left = parse_unary_expression(p);
+    if (peek_next_token(p).type != '(') return false;
 
-    Token token;
-    Ast_Binary_Operator *bin;
-
-    while (1) {
-        token = peek_next_token(p);
-        int token_precedence = operator_precedence_from_token_type(token.type);
-        if (token_precedence < precedence || p->reported_error) {
-            return left;
-        }
-        // TODO: Do we even check that it's a valid binary operator?
-        eat_next_token(p);
-        bin = ast_alloc(p, token.location, AST_BINARY_OPERATOR, sizeof(*bin));
-        bin->left = left;
-        bin->operator_type = token.type;
-        bin->right = parse_binary_expression(p, NULL, token_precedence + 1);
-        bin->_expression.location = location_info_begin_end(bin->left->location, bin->right->location);
-        left = xx bin;
+    Token token = peek_token(p, 1);
+    switch (token.type) {
+    case TOKEN_IDENT:         return peek_token(p, 2).type != ':';
+    case ')':                 return false;
+    case TOKEN_KEYWORD_USING: return false;
+    default:                  return true;
     }
+}
 
-    UNREACHABLE;
+static bool is_unary_operator(int type)
+{
+    return type == '-' || type == '*' || type == '!' || type == TOKEN_BITWISE_NOT;
 }
 
-Ast_Expression *parse_unary_expression(Parser *p)
+// Gives a pending operator from Parser.operator_stack its last operand.
+static Ast_Expression *finish_operator(Ast_Expression *op, Ast_Expression *operand)
 {
-    Token token = peek_next_token(p);
-    switch (token.type) {
-    case '-':
-    case '*':
-    case '!':
-    case TOKEN_BITWISE_NOT:
-    {
-        eat_next_token(p);
-        Ast_Unary_Operator *unary = ast_alloc(p, token.location, AST_UNARY_OPERATOR, sizeof(*unary));
-        unary->operator_type = token.type;
-        unary->subexpression = parse_unary_expression(p);
-        if (!unary->subexpression) return NULL;
-        unary->_expression.location = location_info_begin_end(token.location, unary->subexpression->location);
-        return xx unary;
+    if (op->kind == AST_UNARY_OPERATOR) {
+        if (!operand) return NULL;
+        Ast_Unary_Operator *unary = xx op;
+        unary->subexpression = ast_handle(operand);
+        unary->_expression.location = location_info_begin_end(op->location, operand->location);
+        return op;
+    }
+
+    assert(op->kind == AST_BINARY_OPERATOR);
+    Ast_Binary_Operator *bin = xx op;
+    bin->right = ast_handle(operand);
+    if (bin->left && operand) bin->_expression.location = location_info_begin_end(ast_expr(bin->left)->location, operand->location);
+    return op;
+}
+
+static inline Ast_Expression *top_operator(Parser *p, size_t base)
+{
+    return arrlenu(p->operator_stack) > base ? arrlast(p->operator_stack) : NULL;
+}
+
+static inline bool top_is_binary_operator(Parser *p, size_t base)
+{
+    Ast_Expression *top = top_operator(p, base);
+    return top && top->kind == AST_BINARY_OPERATOR;
+}
+
+// Operator precedence parsing without recursion: operators waiting for their right operand, unary
+// operators waiting for their subexpression and open parentheses all go on p->operator_stack,
+// so neither long operator chains nor deep nesting grow the C stack. Operators of equal precedence
+// associate to the left. Nested calls (procedure arguments, subscripts, ...) share the stack above
+// their own base.
+Ast_Expression *parse_expression(Parser *p)
+{
+    size_t base = arrlenu(p->operator_stack);
+    Ast_Expression *operand;
+
+    while (1) {
+        // Prefix position: unary operators and open parentheses, then an operand.
+        while (1) {
+            Token token = peek_next_token(p);
+            if (is_unary_operator(token.type)) {
+                eat_next_token(p);
+                Ast_Unary_Operator *unary = ast_alloc(token.location, AST_UNARY_OPERATOR);
+                unary->operator_type = token.type;
+                arrput(p->operator_stack, xx unary);
+            } else if (at_open_parenthesis(p)) {
+                eat_next_token(p);
+                arrput(p->operator_stack, NULL);
+            } else {
+                break;
+            }
+        }
+        operand = parse_primary_expression(p, NULL);
+
+        // Operator position.
+        bool need_operand = false;
+        while (!need_operand) {
+            // Unary operators bind tighter than any binary operator.
+            while (1) {
+                Ast_Expression *top = top_operator(p, base);
+                if (!top || top->kind != AST_UNARY_OPERATOR) break;
+                operand = finish_operator(arrpop(p->operator_stack), operand);
+            }
+            if (!operand || p->reported_error) goto unwind;
+
+            Token token = peek_next_token(p);
+            int precedence = operator_precedence_from_token_type(token.type);
+
+            while (top_is_binary_operator(p, base)) {
+                Ast_Binary_Operator *top = xx top_operator(p, base);
+                if (precedence && operator_precedence_from_token_type(top->operator_type) < precedence) break;
+                operand = finish_operator(arrpop(p->operator_stack), operand);
+            }
+
+            if (precedence) {
+                // TODO: Do we even check that it's a valid binary operator?
+                eat_next_token(p);
+                Ast_Binary_Operator *bin = ast_alloc(token.location, AST_BINARY_OPERATOR);
+                bin->left = ast_handle(operand);
+                bin->operator_type = token.type;
+                arrput(p->operator_stack, xx bin);
+                need_operand = true;
+            } else if (arrlenu(p->operator_stack) > base) {
+                // Only an open parenthesis is left on top.
+                assert(arrlast(p->operator_stack) == NULL);
+                (void)arrpop(p->operator_stack);
+                eat_token_type(p, ')', "Missing closing parenthesis around expression.");
+                if (p->reported_error) goto unwind;
+                operand = parse_primary_expression(p, operand);
+            } else {
+                return operand;
+            }
+        }
     }
-    default:
-        return parse_primary_expression(p, NULL);
+
+unwind:
+    while (arrlenu(p->operator_stack) > base) {
+        Ast_Expression *op = arrpop(p->operator_stack);
+        if (op) operand = finish_operator(op, operand);
     }
+    return operand;
 }
 
 Ast_Expression *parse_primary_expression(Parser *p, Ast_Expression *base)
@@ -251,23 +408,23 @@ Ast_Expression *parse_primary_expression(Parser *p, Ast_Expression *base)
 
             switch (token.type) {
             case '*': {
-                Ast_Unary_Operator *unary = ast_alloc(p, token.location, AST_UNARY_OPERATOR, sizeof(*unary));
-                unary->subexpression = base;
+                Ast_Unary_Operator *unary = ast_alloc(token.location, AST_UNARY_OPERATOR);
+                unary->subexpression = ast_handle(base);
                 unary->operator_type = TOKEN_POINTER_DEREFERENCE;
                 base = xx unary;
                 break;
             }
             case '{': {
-                Ast_Type_Instantiation *inst = ast_alloc(p, token.location, AST_TYPE_INSTANTIATION, sizeof(*inst));
-                inst->type_definition = parse_type_definition(p, base);
+                Ast_Type_Instantiation *inst = ast_alloc(token.location, AST_TYPE_INSTANTIATION);
+                inst->type_definition = ast_handle(parse_type_definition(p, base));
                 if (p->reported_error) return base;
                 Ast_Expression *arg = parse_expression(p);
-                arrput(inst->arguments, arg);
+                arrput(inst->arguments, ast_handle(arg));
                 while (peek_next_token(p).type == ',') {
                     if (p->reported_error) return xx inst;
                     eat_next_token(p); // eat comma
                     arg = parse_expression(p);
-                    arrput(inst->arguments, arg);
+                    arrput(inst->arguments, ast_handle(arg));
                 }
                 eat_token_type(p, '}', "Missing closing curly brace around type instantiation arguments list.");
                 base = xx inst;
@@ -275,9 +432,9 @@ Ast_Expression *parse_primary_expression(Parser *p, Ast_Expression *base)
             }
             case TOKEN_IDENT: {
                 Source_Location loc = location_info_begin_end(base->location, token.location);
-                Ast_Selector *selector = ast_alloc(p, loc, AST_SELECTOR, sizeof(*selector));
-                selector->namespace_expression = base;
-                selector->ident = make_identifier(p, token);
+                Ast_Selector *selector = ast_alloc(loc, AST_SELECTOR);
+                selector->namespace_expression = ast_handle(base);
+                selector->ident = ast_handle(make_identifier(p, token));
                 selector->struct_field_index = -1;
                 base = xx selector;
                 break;
@@ -291,19 +448,21 @@ Ast_Expression *parse_primary_expression(Parser *p, Ast_Expression *base)
         }
         case '[': {
             eat_next_token(p);
-            Ast_Binary_Operator *binary = ast_alloc(p, token.location, AST_BINARY_OPERATOR, sizeof(*binary));
-            binary->left = base;
+            Ast_Binary_Operator *binary = ast_alloc(token.location, AST_BINARY_OPERATOR);
+            Ast_Expression *subscript = parse_expression(p);
+            if (!subscript) return base;
+            binary->left = ast_handle(base);
             binary->operator_type = TOKEN_ARRAY_SUBSCRIPT;
-            binary->right = parse_expression(p);
-            binary->_expression.location = location_info_begin_end(binary->left->location, binary->right->location);
+            binary->right = ast_handle(subscript);
+            binary->_expression.location = location_info_begin_end(base->location, subscript->location);
             base = xx binary;
             eat_token_type(p, ']', "Missing closing bracket after array subscript.");
             break;
         }
         case '(': {
             eat_next_token(p);
-            Ast_Procedure_Call *call = ast_alloc(p, base->location, AST_PROCEDURE_CALL, sizeof(*call));
-            call->procedure_expression = base;
+            Ast_Procedure_Call *call = ast_alloc(base->location, AST_PROCEDURE_CALL);
+            call->procedure_expression = ast_handle(base);
 
             if (peek_next_token(p).type == ')') {
                 eat_next_token(p);
@@ -312,13 +471,13 @@ Ast_Expression *parse_primary_expression(Parser *p, Ast_Expression *base)
             }
 
             Ast_Expression *arg = parse_expression(p);
-            arrput(call->arguments, arg);
+            arrput(call->arguments, ast_handle(arg));
 
             while (peek_next_token(p).type == ',') {
                 eat_next_token(p);
                 arg = parse_expression(p);
                 if (p->reported_error) return xx call;
-                arrput(call->arguments, arg);
+                arrput(call->arguments, ast_handle(arg));
             }
             eat_token_type(p, ')', "Expected closing parenthesis after procedure call argument list.");
             
@@ -327,9 +486,9 @@ Ast_Expression *parse_primary_expression(Parser *p, Ast_Expression *base)
         }
         case TOKEN_KEYWORD_AS: {
             eat_next_token(p);
-            Ast_Cast *cast = ast_alloc(p, token.location, AST_CAST, sizeof(*cast));
-            cast->type = parse_type_definition(p, NULL);
-            cast->subexpression = base;
+            Ast_Cast *cast = ast_alloc(token.location, AST_CAST);
+            cast->type = ast_handle(parse_type_definition(p, NULL));
+            cast->subexpression = ast_handle(base);
             cast->value_cast = true;
 
             base = xx cast;
@@ -345,6 +504,11 @@ Ast_Expression *parse_primary_expression(Parser *p, Ast_Expression *base)
 
 Ast_Expression *parse_base_expression(Parser *p)
 {
+    // Only a procedure right at the start of a declaration's value can be skipped, one nested
+    // deeper in an expression is never asked for by name.
+    bool may_skip_body = p->procedure_body_may_be_skipped;
+    p->procedure_body_may_be_skipped = false;
+
     Token token = peek_next_token(p);
     switch (token.type) {
     case TOKEN_IDENT: {
@@ -359,7 +523,7 @@ Ast_Expression *parse_base_expression(Parser *p)
         
     case TOKEN_NUMBER: {
         eat_next_token(p);
-        Ast_Number *number = ast_alloc(p, token.location, AST_NUMBER, sizeof(*number));
+        Ast_Number *number = ast_alloc(token.location, AST_NUMBER);
         number->flags = token.number_flags;
 
         if (token.number_flags & NUMBER_FLAGS_FLOAT) {
@@ -373,7 +537,7 @@ Ast_Expression *parse_base_expression(Parser *p)
         
     case TOKEN_STRING: {
         eat_next_token(p);
-        Ast_Literal *lit = ast_alloc(p, token.location, AST_LITERAL, sizeof(*lit));
+        Ast_Literal *lit = ast_alloc(token.location, AST_LITERAL);
         lit->kind = LITERAL_STRING;
         lit->string_value = token.string_value;
         return xx lit;
@@ -381,7 +545,7 @@ Ast_Expression *parse_base_expression(Parser *p)
         
     case TOKEN_KEYWORD_TRUE: {
         eat_next_token(p);
-        Ast_Literal *lit = ast_alloc(p, token.location, AST_LITERAL, sizeof(*lit));
+        Ast_Literal *lit = ast_alloc(token.location, AST_LITERAL);
         lit->kind = LITERAL_BOOL;
         lit->bool_value = 1;
         return xx lit;
@@ -389,7 +553,7 @@ Ast_Expression *parse_base_expression(Parser *p)
 
     case TOKEN_KEYWORD_FALSE: {
         eat_next_token(p);
-        Ast_Literal *lit = ast_alloc(p, token.location, AST_LITERAL, sizeof(*lit));
+        Ast_Literal *lit = ast_alloc(token.location, AST_LITERAL);
         lit->kind = LITERAL_BOOL;
         lit->bool_value = 0;
         return xx lit;
@@ -397,7 +561,7 @@ Ast_Expression *parse_base_expression(Parser *p)
 
     case TOKEN_KEYWORD_NULL: {
         eat_next_token(p);
-        Ast_Literal *lit = ast_alloc(p, token.location, AST_LITERAL, sizeof(*lit));
+        Ast_Literal *lit = ast_alloc(token.location, AST_LITERAL);
         lit->kind = LITERAL_NULL;
         return xx lit;
     }
@@ -419,7 +583,7 @@ Ast_Expression *parse_base_expression(Parser *p)
         {
             Ast_Type_Definition *lambda_type = parse_lambda_type(p);
             token = peek_next_token(p);
-            if (token.type == '{' || token.type == TOKEN_DIRECTIVE_FOREIGN) return xx parse_procedure(p, lambda_type);
+            if (token.type == '{' || token.type == TOKEN_DIRECTIVE_FOREIGN) return xx parse_procedure(p, lambda_type, may_skip_body);
             return xx lambda_type;
         }
         }
@@ -442,7 +606,41 @@ Ast_Expression *parse_base_expression(Parser *p)
     return NULL;
 }
 
-Ast_Procedure *parse_procedure(Parser *p, Ast_Type_Definition *lambda_type)
+// Moves the declarations and #loads of a parser that parsed part of our file over to us.
+static void parser_absorb(Parser *p, Parser *sub)
+{
+    size_t base = arrlenu(p->declarations);
+    For (sub->declarations) arrput(p->declarations, sub->declarations[it]);
+    For (sub->toplevel) {
+        Toplevel_Entry entry = sub->toplevel[it];
+        entry.declaration_count += base;
+        arrput(p->toplevel, entry);
+    }
+    if (sub->reported_error) p->reported_error = true;
+    parser_free(sub);
+}
+
+// Matches braces up to the end of the body. Returns false if we have to parse it now after all.
+static bool skip_procedure_body(Parser *p, Ast_Procedure *proc)
+{
+    int depth = 1;
+    while (depth > 0) {
+        Token token = eat_next_token(p);
+        switch (token.type) {
+        case '{': depth += 1; break;
+        case '}': depth -= 1; break;
+        case TOKEN_DIRECTIVE_LOAD: return false; // Files are loaded while parsing, later is too late.
+        case TOKEN_END_OF_INPUT:
+            parser_report_error(p, token.location, "Reached the end of the input before terminating curly brace.");
+            parser_report_error(p, proc->_expression.location, "... the block started here.");
+            return true;
+        }
+        if (p->reported_error) return true;
+    }
+    return true;
+}
+
+Ast_Procedure *parse_procedure(Parser *p, Ast_Type_Definition *lambda_type, bool skip_body)
 {
     if (!lambda_type) lambda_type = parse_lambda_type(p);
 
@@ -453,29 +651,64 @@ Ast_Procedure *parse_procedure(Parser *p, Ast_Type_Definition *lambda_type)
         if (p->reported_error) return NULL;
 
         // TODO: parse an identifier with which library the declaration is from.
-        Ast_Procedure *proc = ast_alloc(p, lambda_type->_expression.location, AST_PROCEDURE, sizeof(*proc));
-        proc->lambda_type = lambda_type;
-        proc->foreign_library_name = make_identifier(p, token);
-        Exit_Block(p, lambda_type->lambda.arguments_block);
+        Ast_Procedure *proc = ast_alloc(lambda_type->_expression.location, AST_PROCEDURE);
+        proc->lambda_type = ast_handle(lambda_type);
+        proc->foreign_library_name = ast_handle(make_identifier(p, token));
+        Exit_Block(p, ast_block(lambda_type->lambda.arguments_block));
         return proc;
     }
 
     Token token = eat_token_type(p, '{', "Expected opening curly brace after lambda type.");
 
-    Ast_Procedure *proc = ast_alloc(p, token.location, AST_PROCEDURE, sizeof(*proc));
-    proc->lambda_type = lambda_type;
-    proc->body_block = ast_alloc(p, token.location, AST_BLOCK, sizeof(Ast_Block));
-    proc->body_block->belongs_to = BLOCK_BELONGS_TO_LAMBDA;
-    proc->body_block->belongs_to_data = proc;
+    // @Volatile: The location is that of the '{', parse_skipped_procedure_body() starts right after it.
+    Ast_Procedure *proc = ast_alloc(token.location, AST_PROCEDURE);
+    proc->lambda_type = ast_handle(lambda_type);
+
+    if (skip_body) {
+        proc->body_is_skipped = true;
+        if (skip_procedure_body(p, proc)) {
+            p->skipped_procedure = proc;
+        } else {
+            parser_absorb(p, parse_skipped_procedure_body(p->workspace, proc));
+        }
+        Exit_Block(p, ast_block(lambda_type->lambda.arguments_block));
+        return proc;
+    }
+
+    parse_procedure_body(p, proc);
+    Exit_Block(p, ast_block(lambda_type->lambda.arguments_block));
+
+    return proc;
+}
+
+// Assumes the '{' has been consumed, and that the arguments block is the current block.
+void parse_procedure_body(Parser *p, Ast_Procedure *proc)
+{
+    Ast_Block *block = ast_alloc(proc->_expression.location, AST_BLOCK);
+    block->belongs_to = BLOCK_BELONGS_TO_LAMBDA;
+    proc->body_block = ast_handle(block);
+    block->belongs_to_data = ast_handle(proc);
 
     Ast_Procedure *previous = p->current_procedure;
 
     p->current_procedure = proc;
-    parse_into_block(p, proc->body_block);
-    Exit_Block(p, lambda_type->lambda.arguments_block);
-    p->current_procedure= previous;
+    parse_into_block(p, block);
+    p->current_procedure = previous;
+}
 
-    return proc;
+// Parses a body that parse_procedure() only matched the braces of, with a parser of its own.
+// The caller takes the declarations made in the body and frees the parser.
+Parser *parse_skipped_procedure_body(Workspace *w, Ast_Procedure *proc)
+{
+    assert(proc->body_is_skipped && !proc->body_block);
+
+    Source_Location location = proc->_expression.location;
+    Parser *p = parser_init(w, location.fid);
+    p->cursor = p->input_begin + location.offset + 1;
+    p->current_block = ast_block(ast_type(proc->lambda_type)->lambda.arguments_block);
+
+    parse_procedure_body(p, proc);
+    return p;
 }
 
 Ast_Declaration *parse_lambda_argument(Parser *p, unsigned index)
@@ -503,20 +736,20 @@ Ast_Declaration *parse_lambda_argument(Parser *p, unsigned index)
 
     // Parse the parameter declaration.
     Ast_Declaration *decl = make_declaration(p, token.location);
-    decl->ident = make_identifier(p, token);
+    decl->ident = ast_handle(make_identifier(p, token));
     decl->flags = flags;
 
     // Add the declaration to the block and create a variable.
     checked_add_to_scope(p, p->current_block, decl);
 
-    Ast_Variable *var = ast_alloc(p, decl->location, AST_VARIABLE, sizeof(*var));
-    var->declaration = decl;
+    Ast_Variable *var = ast_alloc(decl->location, AST_VARIABLE);
+    var->declaration = ast_handle(decl);
     var->lambda_argument_index = index;
-    arrput(p->current_block->statements, xx var);
+    arrput(p->current_block->statements, ast_handle(var));
 
     eat_token_type(p, ':', "Expected ':' after lambda argument name.");
 
-    decl->my_type = parse_type_definition(p, NULL);
+    decl->my_type = ast_handle(parse_type_definition(p, NULL));
 
     // TODO: this doesn't handle default values for arguments.
     // I think we can just say the expression has to be a constant, and go ahead and set the type definition here.
@@ -532,15 +765,16 @@ Ast_Type_Definition *parse_struct_desc(Parser *p)
     // Note: This will need to change when we introduce struct parameters.
     token = eat_token_type(p, '{', "Expected '{' after 'struct'.");
     
-    Ast_Struct *struct_desc = arena_alloc(p->arena, sizeof(*struct_desc));
-    struct_desc->block = ast_alloc(p, token.location, AST_BLOCK, sizeof(*struct_desc->block));
-    struct_desc->block->belongs_to = BLOCK_BELONGS_TO_STRUCT;
-    struct_desc->block->belongs_to_data = struct_desc;
+    Ast_Struct *struct_desc = ast_pool_alloc(AST_POOL_STRUCT);
+    Ast_Block *block = ast_alloc(token.location, AST_BLOCK);
+    block->belongs_to = BLOCK_BELONGS_TO_STRUCT;
+    block->belongs_to_data = ast_handle(struct_desc);
+    struct_desc->block = ast_handle(block);
 
-    parse_into_block(p, struct_desc->block);
+    parse_into_block(p, block);
 
     Ast_Type_Definition *defn = make_type_definition(p, token.location, TYPE_DEF_STRUCT);
-    defn->struct_desc = struct_desc;
+    defn->struct_desc = ast_handle(struct_desc);
     return defn;
 }
 
@@ -549,28 +783,29 @@ Ast_Type_Definition *parse_enum_defn(Parser *p)
     Token token = eat_next_token(p);
     assert(token.type == TOKEN_KEYWORD_ENUM);
 
-    Ast_Enum *enum_defn = arena_alloc(p->arena, sizeof(*enum_defn));
+    Ast_Enum *enum_defn = ast_pool_alloc(AST_POOL_ENUM);
     Ast_Type_Definition *defn = make_type_definition(p, token.location, TYPE_DEF_ENUM);
-    defn->enum_defn = enum_defn;
+    defn->enum_defn = ast_handle(enum_defn);
 
     // Parse underlying int type.
     token = peek_next_token(p);
     if (token.type == TOKEN_IDENT) {
         eat_next_token(p);
-        enum_defn->underlying_int_type = parse_literal_type(p, token.string_value);
+        enum_defn->underlying_int_type = ast_handle(parse_literal_type(p, token.string_value));
         if (!enum_defn->underlying_int_type) {
             parser_report_error(p, token.location, "Expected an integer literal type name after 'enum' (aliases are not currently implemented).");
             return defn;
         }
     } else {
-        enum_defn->underlying_int_type = p->workspace->type_def_u32; // TODO: check this.
+        enum_defn->underlying_int_type = ast_handle(p->workspace->type_def_u32); // TODO: check this.
     }
 
     token = eat_token_type(p, '{', "Expected '{' after 'enum'.");
 
-    enum_defn->block = ast_alloc(p, token.location, AST_BLOCK, sizeof(*enum_defn->block));
-    enum_defn->block->belongs_to = BLOCK_BELONGS_TO_ENUM;
-    enum_defn->block->belongs_to_data = enum_defn;
+    Ast_Block *block = ast_alloc(token.location, AST_BLOCK);
+    block->belongs_to = BLOCK_BELONGS_TO_ENUM;
+    block->belongs_to_data = ast_handle(enum_defn);
+    enum_defn->block = ast_handle(block);
 
     while (1) {
         if (peek_next_token(p).type == '}') {
@@ -600,11 +835,11 @@ Ast_Type_Definition *parse_enum_defn(Parser *p)
         if (!value) return NULL;
         eat_token_type(p, ';', "Expected semicolon after declaration.");
         Ast_Declaration *member = make_declaration(p, token.location);
-        member->ident = make_identifier(p, token);
-        member->my_type = defn; // The type of the declaration is the enum type.
-        member->my_value = value;
+        member->ident = ast_handle(make_identifier(p, token));
+        member->my_type = ast_handle(defn); // The type of the declaration is the enum type.
+        member->my_value = ast_handle(value);
         member->flags = DECLARATION_IS_CONSTANT | DECLARATION_IS_ENUM_VALUE;
-        arrput(enum_defn->block->declarations, member);
+        block_add_declaration(block, member);
 
         if (p->reported_error) return defn;
     }
@@ -625,9 +860,10 @@ Ast_Type_Definition *parse_lambda_type(Parser *p)
 
     // Open a scope for the arguments.
     
-    type_definition->lambda.arguments_block = ast_alloc(p, token.location, AST_BLOCK, sizeof(Ast_Block));
-    type_definition->lambda.arguments_block->belongs_to = BLOCK_IS_LAMBDA_ARGUMENTS;
-    Enter_Block(p, type_definition->lambda.arguments_block);
+    Ast_Block *arguments_block = ast_alloc(token.location, AST_BLOCK);
+    arguments_block->belongs_to = BLOCK_IS_LAMBDA_ARGUMENTS;
+    type_definition->lambda.arguments_block = ast_handle(arguments_block);
+    Enter_Block(p, arguments_block);
 
     // Check for closing paren, meaning an empty argument list.
 
@@ -636,9 +872,9 @@ Ast_Type_Definition *parse_lambda_type(Parser *p)
         token = peek_next_token(p); 
         if (token.type == TOKEN_RIGHT_ARROW) {
             eat_next_token(p);
-            type_definition->lambda.return_type = parse_type_definition(p, NULL);
+            type_definition->lambda.return_type = ast_handle(parse_type_definition(p, NULL));
         } else {
-            type_definition->lambda.return_type = p->workspace->type_def_void;
+            type_definition->lambda.return_type = ast_handle(p->workspace->type_def_void);
         }
         return type_definition;
     }
@@ -655,9 +891,9 @@ Ast_Type_Definition *parse_lambda_type(Parser *p)
             token = peek_next_token(p); 
             if (token.type == TOKEN_RIGHT_ARROW) {
                 eat_next_token(p);
-                type_definition->lambda.return_type = parse_type_definition(p, NULL);
+                type_definition->lambda.return_type = ast_handle(parse_type_definition(p, NULL));
             } else {
-                type_definition->lambda.return_type = p->workspace->type_def_void;
+                type_definition->lambda.return_type = ast_handle(p->workspace->type_def_void);
             }
             return type_definition;
         }
@@ -678,9 +914,9 @@ Ast_Type_Definition *parse_lambda_type(Parser *p)
             token = peek_next_token(p); 
             if (token.type == TOKEN_RIGHT_ARROW) {
                 eat_next_token(p);
-                type_definition->lambda.return_type = parse_type_definition(p, NULL);
+                type_definition->lambda.return_type = ast_handle(parse_type_definition(p, NULL));
             } else {
-                type_definition->lambda.return_type = p->workspace->type_def_void;
+                type_definition->lambda.return_type = ast_handle(p->workspace->type_def_void);
             }
             return type_definition;
         }
@@ -736,11 +972,11 @@ Ast_Type_Definition *parse_type_definition(Parser *parser, Ast_Expression *type_
         case AST_IDENT: {
             Ast_Ident *ident = xx type_expression;
 
-            Ast_Type_Definition *literal_type_defn = parse_literal_type(parser, ident->name);
+            Ast_Type_Definition *literal_type_defn = parse_literal_type(parser, ident->name->name);
             if (literal_type_defn) return literal_type_defn;
 
             Ast_Type_Definition *defn = make_type_definition(parser, type_expression->location, TYPE_DEF_IDENT);
-            defn->type_name = ident;
+            defn->type_name = ast_handle(ident);
             return defn;
         }
             
@@ -761,7 +997,7 @@ Ast_Type_Definition *parse_type_definition(Parser *parser, Ast_Expression *type_
             //     defn->pointer_level += 1;
             //     type_expression = unary->subexpression;
             // }
-            defn->pointer_to = parse_type_definition(parser, unary->subexpression);
+            defn->pointer_to = ast_handle(parse_type_definition(parser, ast_expr(unary->subexpression)));
             return defn;
         }
 
@@ -783,7 +1019,7 @@ Ast_Type_Definition *parse_type_definition(Parser *parser, Ast_Expression *type_
 
         case AST_PROCEDURE_CALL: {
             Ast_Type_Definition *defn = make_type_definition(parser, type_expression->location, TYPE_DEF_STRUCT_CALL);
-            defn->struct_call = (Ast_Procedure_Call *)type_expression;
+            defn->struct_call = ast_handle(type_expression);
             return defn;
         }
         }
@@ -794,7 +1030,7 @@ Ast_Type_Definition *parse_type_definition(Parser *parser, Ast_Expression *type_
     case '*': {
         eat_next_token(parser);
         Ast_Type_Definition *defn = make_type_definition(parser, token.location, TYPE_DEF_POINTER);
-        defn->pointer_to = parse_type_definition(parser, NULL);
+        defn->pointer_to = ast_handle(parse_type_definition(parser, NULL));
         return defn;
     }
     case '[': {
@@ -807,7 +1043,7 @@ Ast_Type_Definition *parse_type_definition(Parser *parser, Ast_Expression *type_
         case ']':
             eat_next_token(parser); // ]
             defn->array.kind = ARRAY_KIND_SLICE;
-            defn->array.element_type = parse_type_definition(parser, NULL);
+            defn->array.element_type = ast_handle(parse_type_definition(parser, NULL));
             return defn;
         case TOKEN_NUMBER:
             eat_next_token(parser); // number
@@ -817,13 +1053,13 @@ Ast_Type_Definition *parse_type_definition(Parser *parser, Ast_Expression *type_
             eat_token_type(parser, ']', "Missing closing bracket after array length.");
             defn->array.length = token.integer_value;
             defn->array.kind = ARRAY_KIND_FIXED;
-            defn->array.element_type = parse_type_definition(parser, NULL);
+            defn->array.element_type = ast_handle(parse_type_definition(parser, NULL));
             return defn;
         case TOKEN_DOUBLE_DOT:
             eat_next_token(parser); // ..
             eat_token_type(parser, ']', "Missing closing bracket after array length.");
             defn->array.kind = ARRAY_KIND_DYNAMIC;
-            defn->array.element_type = parse_type_definition(parser, NULL);
+            defn->array.element_type = ast_handle(parse_type_definition(parser, NULL));
             return defn;
         default:
             parser_report_error(parser, token.location, "Here we expected a type, but we got '%s'.", token_type_to_string(token.type));
@@ -836,12 +1072,12 @@ Ast_Type_Definition *parse_type_definition(Parser *parser, Ast_Expression *type_
         if (literal_type_defn) return literal_type_defn;
 
         Ast_Type_Definition *defn = make_type_definition(parser, token.location, TYPE_DEF_IDENT);
-        defn->type_name = make_identifier(parser, token);
+        defn->type_name = ast_handle(make_identifier(parser, token));
         return defn;
     }
     case '(': {
         Ast_Type_Definition *lambda_type = parse_lambda_type(parser);
-        Exit_Block(parser, lambda_type->lambda.arguments_block);
+        Exit_Block(parser, ast_block(lambda_type->lambda.arguments_block));
         return lambda_type;
     }
     case TOKEN_KEYWORD_STRUCT:
@@ -862,8 +1098,8 @@ Ast_Statement *parse_while_statement(Parser *p)
 
     Ast_Statement *previous_loop = p->current_loop;
         
-    Ast_While *while_stmt = ast_alloc(p, token.location, AST_WHILE, sizeof(*while_stmt));
-    while_stmt->condition_expression = parse_expression(p);
+    Ast_While *while_stmt = ast_alloc(token.location, AST_WHILE);
+    while_stmt->condition_expression = ast_handle(parse_expression(p));
     if (!while_stmt->condition_expression) return NULL;
 
     p->current_loop = xx while_stmt;
@@ -874,7 +1110,7 @@ Ast_Statement *parse_while_statement(Parser *p)
     if (token.type == TOKEN_KEYWORD_THEN) {
         eat_next_token(p);
     }
-    while_stmt->then_statement = parse_statement(p);
+    while_stmt->then_statement = ast_handle(parse_statement(p));
 
     p->current_loop = previous_loop;
 
@@ -886,9 +1122,9 @@ Ast_Statement *parse_if_statement(Parser *p)
     Token token = eat_next_token(p);
     assert(token.type == TOKEN_KEYWORD_IF);
 
-    Ast_If *if_stmt = ast_alloc(p, token.location, AST_IF, sizeof(*if_stmt));
+    Ast_If *if_stmt = ast_alloc(token.location, AST_IF);
     
-    if_stmt->condition_expression = parse_expression(p);
+    if_stmt->condition_expression = ast_handle(parse_expression(p));
     if (!if_stmt->condition_expression) return NULL;
 
     // Check for "then" keyword and consume it.
@@ -896,13 +1132,13 @@ Ast_Statement *parse_if_statement(Parser *p)
     if (token.type == TOKEN_KEYWORD_THEN) {
         eat_next_token(p);
     }
-    if_stmt->then_statement = parse_statement(p);
+    if_stmt->then_statement = ast_handle(parse_statement(p));
 
     // Check for "else" keyword and consume it.
     token = peek_next_token(p);
     if (token.type == TOKEN_KEYWORD_ELSE) {
         eat_next_token(p);
-        if_stmt->else_statement = parse_statement(p);
+        if_stmt->else_statement = ast_handle(parse_statement(p));
     }
 
     return xx if_stmt;
@@ -915,52 +1151,53 @@ Ast_Statement *parse_for_statement(Parser *p)
     
     Ast_Statement *previous_loop = p->current_loop;
         
-    Ast_For *for_stmt = ast_alloc(p, token.location, AST_FOR, sizeof(*for_stmt));
+    Ast_For *for_stmt = ast_alloc(token.location, AST_FOR);
 
     // We create an implicit block for the "it" and "it_index" declarations.
-    Ast_Block *block = ast_alloc(p, token.location, AST_BLOCK, sizeof(*block));
+    Ast_Block *block = ast_alloc(token.location, AST_BLOCK);
     Enter_Block(p, block);
 
-    for_stmt->iterator_declaration = make_declaration(p, token.location);
-    for_stmt->iterator_declaration->flags = DECLARATION_IS_FOR_LOOP_ITERATOR | DECLARATION_HAS_BEEN_TYPECHECKED;
+    Ast_Declaration *iterator = make_declaration(p, token.location);
+    iterator->flags = DECLARATION_IS_FOR_LOOP_ITERATOR | DECLARATION_HAS_BEEN_TYPECHECKED;
+    for_stmt->iterator_declaration = ast_handle(iterator);
 
-    Ast_Number *zero = ast_alloc(p, token.location, AST_NUMBER, sizeof(*zero));
+    Ast_Number *zero = ast_alloc(token.location, AST_NUMBER);
     zero->as.integer = 0;
-    zero->_expression.inferred_type = p->workspace->type_def_int;
-    for_stmt->iterator_declaration->my_type = p->workspace->type_def_int;
-    for_stmt->iterator_declaration->my_value = xx zero;
+    zero->_expression.inferred_type = ast_handle(p->workspace->type_def_int);
+    iterator->my_type = ast_handle(p->workspace->type_def_int);
+    iterator->my_value = ast_handle(zero);
 
     if (peek_next_token(p).type == TOKEN_IDENT && peek_token(p, 1).type == ':') {
         token = eat_next_token(p);
         eat_next_token(p); // ':'
     } else {
-        token.string_value.data = "it";
-        token.string_value.count = 2;
+        token.string_value = p->workspace->atom_it->name;
+        token.identifier_hash = p->workspace->atom_it->hash;
     }
 
-    for_stmt->iterator_declaration->ident = make_identifier(p, token); // This uses the location of TOKEN_KEYWORD_FOR.
-    checked_add_to_scope(p, p->current_block, for_stmt->iterator_declaration);
+    iterator->ident = ast_handle(make_identifier(p, token)); // This uses the location of TOKEN_KEYWORD_FOR.
+    checked_add_to_scope(p, p->current_block, iterator);
 
     // Parse the value we are iterating over.
-    for_stmt->range_expression = parse_expression(p);
+    for_stmt->range_expression = ast_handle(parse_expression(p));
     if (!for_stmt->range_expression) return NULL;
 
     // Range-based for loop:  0..n
     if (peek_next_token(p).type == TOKEN_DOUBLE_DOT) {
         token = eat_next_token(p);
-        Ast_Binary_Operator *binary = ast_alloc(p, token.location, AST_BINARY_OPERATOR, sizeof(*binary));
+        Ast_Binary_Operator *binary = ast_alloc(token.location, AST_BINARY_OPERATOR);
         binary->left = for_stmt->range_expression;
         binary->operator_type = token.type;
-        binary->right = parse_expression(p);
+        binary->right = ast_handle(parse_expression(p));
         if (!binary->right) return NULL;
-        binary->_expression.location = location_info_begin_end(binary->left->location, binary->right->location);
+        binary->_expression.location = location_info_begin_end(ast_expr(binary->left)->location, ast_expr(binary->right)->location);
         
-        for_stmt->range_expression = xx binary;
+        for_stmt->range_expression = ast_handle(binary);
     }
 
     p->current_loop = xx for_stmt;
 
-    for_stmt->then_statement = parse_statement(p);
+    for_stmt->then_statement = ast_handle(parse_statement(p));
 
     p->current_loop = previous_loop;
 
@@ -997,7 +1234,7 @@ void parse_into_block(Parser *p, Ast_Block *block)
 
         Ast_Statement *stmt = parse_statement(p);
         if (!stmt) continue; // If we parsed a constant declaration.
-        arrput(block->statements, stmt);
+        arrput(block->statements, ast_handle(stmt));
 
         if (statement_requires_semicolon(xx stmt)) {
             eat_semicolon(p, stmt->location);
@@ -1017,7 +1254,7 @@ inline Ast_Block *parse_block(Parser *p)
     Token token = eat_next_token(p);
     assert(token.type == '{');
 
-    Ast_Block *block = ast_alloc(p, token.location, AST_BLOCK, sizeof(*block));
+    Ast_Block *block = ast_alloc(token.location, AST_BLOCK);
     parse_into_block(p, block);
 
     return block;
@@ -1030,23 +1267,23 @@ Ast_Statement *parse_assignment(Parser *p, Ast_Expression *pointer_expression)
     Ast_Expression *rhs = parse_expression(p);
     if (!rhs) return NULL;
 
-    Ast_Assignment *assign = ast_alloc(p, token.location, AST_ASSIGNMENT, sizeof(*assign));
-    assign->pointer = pointer_expression;
+    Ast_Assignment *assign = ast_alloc(token.location, AST_ASSIGNMENT);
+    assign->pointer = ast_handle(pointer_expression);
     
     if (token.type != '=') {
         // We store  ptr += value  as  ptr = ptr + value;
         
         assert(token.type > 400);
 
-        Ast_Binary_Operator *binary = ast_alloc(p, token.location, AST_BINARY_OPERATOR, sizeof(*binary));
-        binary->left = pointer_expression;
+        Ast_Binary_Operator *binary = ast_alloc(token.location, AST_BINARY_OPERATOR);
+        binary->left = ast_handle(pointer_expression);
         binary->operator_type = token.type - 400;
-        binary->right = rhs;
-        binary->_expression.location = location_info_begin_end(binary->left->location, binary->right->location);
+        binary->right = ast_handle(rhs);
+        binary->_expression.location = location_info_begin_end(ast_expr(binary->left)->location, ast_expr(binary->right)->location);
 
-        assign->value = xx binary;
+        assign->value = ast_handle(binary);
     } else {
-        assign->value = rhs;
+        assign->value = ast_handle(rhs);
     }
 
     return xx assign;
@@ -1062,9 +1299,9 @@ Ast_Statement *parse_statement(Parser *p)
         if (!p->current_procedure) {
             parser_report_error(p, token.location, "Cannot use 'return' outside of a procedure.");
         }
-        Ast_Return *ret = ast_alloc(p, token.location, AST_RETURN, sizeof(*ret));
-        ret->subexpression = parse_expression(p);
-        ret->proc_i_belong_to = p->current_procedure;
+        Ast_Return *ret = ast_alloc(token.location, AST_RETURN);
+        ret->subexpression = ast_handle(parse_expression(p));
+        ret->proc_i_belong_to = ast_handle(p->current_procedure);
         return xx ret;
     }
 
@@ -1086,7 +1323,7 @@ Ast_Statement *parse_statement(Parser *p)
             parser_report_error(p, token.location, "Cannot use '%s' outside of a loop.", token_type_to_string(token.type));
         }
                 
-        Ast_Loop_Control *loop_control = ast_alloc(p, token.location, AST_LOOP_CONTROL, sizeof(*loop_control));
+        Ast_Loop_Control *loop_control = ast_alloc(token.location, AST_LOOP_CONTROL);
         loop_control->keyword_type = token.type;
         // TODO: We want to parse an expression/identifier here for labeled break/continue statements.
         return xx loop_control;
@@ -1094,8 +1331,8 @@ Ast_Statement *parse_statement(Parser *p)
 
     case TOKEN_KEYWORD_USING: {
         UNIMPLEMENTED;
-        Ast_Using *using = ast_alloc(p, token.location, AST_USING, sizeof(*using));
-        using->subexpression = parse_expression(p); // TODO: "using e: Entity;" We need to handle declarations.
+        Ast_Using *using = ast_alloc(token.location, AST_USING);
+        using->subexpression = ast_handle(parse_expression(p)); // TODO: "using e: Entity;" We need to handle declarations.
         return xx using;
     }
 
@@ -1103,10 +1340,11 @@ Ast_Statement *parse_statement(Parser *p)
         eat_next_token(p);
         token = eat_token_type(p, TOKEN_STRING, "Expected a string literal with the file path after #load.");
 
-        void workspace_add_file(Workspace *w, const char *path_as_cstr);
+        int workspace_load_file(Workspace *w, const char *path_as_cstr);
 
         const char *path_as_cstr = arena_sv_to_cstr(&temporary_arena, token.string_value);
-        workspace_add_file(p->workspace, path_as_cstr);
+        int fid = workspace_load_file(p->workspace, path_as_cstr);
+        arrput(p->toplevel, ((Toplevel_Entry){ .loaded_file_index = fid, .declaration_count = arrlenu(p->declarations) }));
         eat_token_type(p, ';', "Expected semicolon after #load directive.");
 
         return NULL;
@@ -1126,8 +1364,8 @@ Ast_Statement *parse_statement(Parser *p)
             // Check for variable declaration.
             if (!(decl->flags & DECLARATION_IS_CONSTANT)) {
                 // We are a variable declaration!
-                Ast_Variable *var = ast_alloc(p, decl->location, AST_VARIABLE, sizeof(*var));
-                var->declaration = decl;
+                Ast_Variable *var = ast_alloc(decl->location, AST_VARIABLE);
+                var->declaration = ast_handle(decl);
                 return xx var;
             }
 
@@ -1159,8 +1397,8 @@ Ast_Statement *parse_statement(Parser *p)
     case TOKEN_BITWISE_XOR_EQUALS:
         return parse_assignment(p, expr);
     default: {
-        Ast_Expression_Statement *stmt = ast_alloc(p, expr->location, AST_EXPRESSION_STATEMENT, sizeof(*stmt));
-        stmt->subexpression = expr;
+        Ast_Expression_Statement *stmt = ast_alloc(expr->location, AST_EXPRESSION_STATEMENT);
+        stmt->subexpression = ast_handle(expr);
         return xx stmt;
     }
     }
@@ -1178,27 +1416,37 @@ void parse_declaration_value(Parser *p, Ast_Declaration *decl)
             Source_Location loc = token.location;
             token = eat_token_type(p, TOKEN_STRING, "Expected a string literal with the library path after #system_library.");
            
-            Ast_Import *import = ast_alloc(p, loc, AST_IMPORT, sizeof(*import)); 
+            Ast_Import *import = ast_alloc(loc, AST_IMPORT); 
             import->path_name = token.string_value;
             import->is_system_library = true;
 
-            decl->my_import = import;
+            decl->my_import = ast_handle(import);
             return;
         }
         
-        decl->my_value = parse_expression(p);
+        // Struct members are looked up through selectors, which don't ask for bodies.
+        p->procedure_body_may_be_skipped = p->workspace->lazy_bodies && p->current_block->belongs_to != BLOCK_BELONGS_TO_STRUCT;
+        p->skipped_procedure = NULL;
+        decl->my_value = ast_handle(parse_expression(p));
+        p->procedure_body_may_be_skipped = false;
+
+        // Something like 'f :: (x: int) { ... } (3);' is not a procedure declaration, nobody will ask for this body by name.
+        if (p->skipped_procedure && decl->my_value != ast_handle(p->skipped_procedure)) {
+            parser_absorb(p, parse_skipped_procedure_body(p->workspace, p->skipped_procedure));
+        }
+        p->skipped_procedure = NULL;
 
         // If we are a procedure definition.
-        if (decl->my_value->kind == AST_PROCEDURE) {
+        if (ast_expr(decl->my_value)->kind == AST_PROCEDURE) {
             decl->flags |= DECLARATION_IS_PROCEDURE;
         }
 
         // If we have a block, we need to set it on the declaration.
-        if (decl->my_value->kind == AST_TYPE_DEFINITION) {
-            Ast_Type_Definition *defn = xx decl->my_value;
+        if (ast_expr(decl->my_value)->kind == AST_TYPE_DEFINITION) {
+            Ast_Type_Definition *defn = ast_get(decl->my_value);
             switch (defn->kind) {
-            case TYPE_DEF_STRUCT: decl->my_block = defn->struct_desc->block; break;
-            case TYPE_DEF_ENUM:   decl->my_block = defn->enum_defn->block; break;
+            case TYPE_DEF_STRUCT: decl->my_block = ast_struct(defn->struct_desc)->block; break;
+            case TYPE_DEF_ENUM:   decl->my_block = ast_enum(defn->enum_defn)->block; break;
             case TYPE_DEF_LAMBDA: decl->my_block = defn->lambda.arguments_block; break;
             default: break;
             }
@@ -1218,12 +1466,12 @@ void parse_declaration_value(Parser *p, Ast_Declaration *decl)
         if (p->current_block->belongs_to == BLOCK_BELONGS_TO_STRUCT) {
             // This means we are a struct field.
             decl->flags |= DECLARATION_IS_STRUCT_FIELD;
-            Ast_Struct *struct_desc = p->current_block->belongs_to_data;
+            Ast_Struct *struct_desc = ast_struct(p->current_block->belongs_to_data);
             decl->struct_field_index = struct_desc->field_count;
             struct_desc->field_count += 1;
         }
 
-        decl->my_value = initializer;
+        decl->my_value = ast_handle(initializer);
         return;
     }
 
@@ -1237,8 +1485,8 @@ Ast_Declaration *parse_declaration(Parser *p)
     eat_token_type(p, ':', "Missing ':' after identifier.");
 
     Ast_Declaration *decl = make_declaration(p, token.location);
-    decl->ident = make_identifier(p, token);
-    decl->ident->resolved_declaration = decl; // TODO: Does this work for overloads.
+    decl->ident = ast_handle(make_identifier(p, token));
+    ast_ident(decl->ident)->resolved_declaration = ast_handle(decl); // TODO: Does this work for overloads.
 
     // Default to not being a struct field, this gets set in parse_declaration_value.
     decl->struct_field_index = -1;
@@ -1263,14 +1511,14 @@ Ast_Declaration *parse_declaration(Parser *p)
     // Otherwise, parse a type.
 
     // parse_type_definition() either converts an expression or parses a new one if NULL is passed.
-    decl->my_type = parse_type_definition(p, NULL);
+    decl->my_type = ast_handle(parse_type_definition(p, NULL));
 
     token = peek_next_token(p);
     if (token.type == ',' || token.type == ';') {
         if (p->current_block->belongs_to == BLOCK_BELONGS_TO_STRUCT) {
             // This means we are a struct field.
             decl->flags |= DECLARATION_IS_STRUCT_FIELD;
-            Ast_Struct *struct_desc = p->current_block->belongs_to_data;
+            Ast_Struct *struct_desc = ast_struct(p->current_block->belongs_to_data);
             decl->struct_field_index = struct_desc->field_count;
             struct_desc->field_count += 1;
         }
@@ -1295,7 +1543,7 @@ void parse_toplevel(Parser *p)
 
         Ast_Statement *stmt = parse_statement(p);
         if (!stmt) continue; // If we parsed a constant declaration.
-        arrput(p->current_block->statements, stmt);
+        arrput(p->current_block->statements, ast_handle(stmt));
 
         if (statement_requires_semicolon(stmt)) {
             eat_semicolon(p, stmt->location);
@@ -1319,22 +1567,29 @@ void parse_toplevel(Parser *p)
 
 void parser_report_error(Parser *parser, Source_Location loc, const char *format, ...)
 {
+    if (parser->errors_are_silent) {
+        parser->reported_error = true;
+        return;
+    }
+
     va_list args;
     va_start(args, format);
 
-    if (loc.l1 < 0) loc.l1 = loc.l0;
-    if (loc.c1 < 0) loc.c1 = loc.c0;
+    // Other files are being parsed at the same time. Keep them from growing the file table under us,
+    // and from printing in the middle of our message.
+    mutex_lock(&parser->workspace->files_mutex);
 
-    Source_File file = parser->workspace->files[parser->file_index];
+    Source_File *file = &parser->workspace->files[loc.fid];
+    Resolved_Location resolved = source_file_resolve_location(file, loc);
 
     // Display the error message.
-    fprintf(stderr, Loc_Fmt": Error: ", SV_Arg(file.path), Loc_Arg(loc));
+    fprintf(stderr, Loc_Fmt": Error: ", SV_Arg(file->path), Loc_Arg(resolved));
     vfprintf(stderr, format, args);
     fprintf(stderr, "\n\n");
 
     // TODO: I want to "normalize" the indentation.
-    // When we add lines to the parser, we can add it
-    // after it has been trimmed to remove leading spaces.
+    // When we look up lines for the diagnostic, we can look them
+    // up after they have been trimmed to remove leading spaces.
     // However, when printing the previous line, if they differ
     // in indentation I want to show that somehow.
     // Basically, if we are like 10 scopes deep in a function,
@@ -1342,11 +1597,11 @@ void parser_report_error(Parser *parser, Source_Location loc, const char *format
     // than the current line, so that when printing diagnostics we
     // don't end up printing like 50 spaces.
 
-    int ln = loc.l0;
+    int ln = resolved.line;
 
     // Display the previous line if it exists.
-    String_View prev = (ln > 0) ? file.lines[ln-1] : SV_NULL;
-    String_View line = file.lines[ln];
+    String_View prev = (ln > 0) ? source_file_get_line(file, ln-1) : SV_NULL;
+    String_View line = source_file_get_line(file, ln);
 
     if (prev.count > 1) {
         size_t count = Min(size_t, prev.count, line.count);
@@ -1359,28 +1614,29 @@ void parser_report_error(Parser *parser, Source_Location loc, const char *format
 
         fprintf(stderr, TAB CYN SV_Fmt RESET, SV_Arg(prev));
 
-        loc.c0 -= n;
-        loc.c1 -= n;
+        resolved.c0 -= n;
+        resolved.c1 -= n;
     } else {
         size_t n = 0;
         while (n < line.count && isspace(line.data[n])) {
             n += 1;
         }
         sv_chop_left(&line, n);
-        loc.c0 -= n;
-        loc.c1 -= n;
+        resolved.c0 -= n;
+        resolved.c1 -= n;
     }
 
     // Highlight the token in red.
 
-    fprintf(stderr, TAB CYN SV_Fmt, loc.c0, line.data);
-    fprintf(stderr,     RED SV_Fmt, loc.c1 - loc.c0, line.data + loc.c0);
-    fprintf(stderr,     CYN SV_Fmt, (int)line.count - loc.c1, line.data + loc.c1);
+    fprintf(stderr, TAB CYN SV_Fmt, resolved.c0, line.data);
+    fprintf(stderr,     RED SV_Fmt, resolved.c1 - resolved.c0, line.data + resolved.c0);
+    fprintf(stderr,     CYN SV_Fmt, (int)line.count - resolved.c1, line.data + resolved.c1);
 
     fprintf(stderr, "\n" RESET);
 
     parser->reported_error = true;
-    
+
+    mutex_unlock(&parser->workspace->files_mutex);
     va_end(args);
 }
 
@@ -1391,38 +1647,121 @@ inline Parser *parser_init(Workspace *w, int file_index)
     parser->file_index = file_index;
     parser->workspace = w;
     parser->arena = context_arena;
-    parser->current_input = sv_from_parts(w->files[file_index].data, w->files[file_index].size);
-    parser->current_line_number = -1;
+
+    mutex_lock(&w->files_mutex);
+    Source_File *file = &w->files[file_index];
+    parser->input_begin = file->data;
+    parser->input_end = parser->input_begin + file->size;
+    if (file->stream && !file->stream->finished) parser->stream = file->stream;
+    mutex_unlock(&w->files_mutex);
+
+    parser->cursor = parser->input_begin;
     return parser;
 }
 
-inline Ast_Expression *parse_expression(Parser *p)
+void parser_free(Parser *parser)
+{
+    arrfree(parser->toplevel);
+    arrfree(parser->declarations);
+    arrfree(parser->operator_stack);
+    if (parser->token_stream) {
+        arrfree(parser->token_stream->types);
+        arrfree(parser->token_stream->locations);
+        arrfree(parser->token_stream->payload_indices);
+        arrfree(parser->token_stream->payloads);
+        free(parser->token_stream);
+    }
+    free(parser);
+}
+
+static void block_index_insert_without_growing(Ast_Block *block, Ast_Handle decl)
+{
+    uint32_t mask = block->index_capacity - 1;
+    Atom *name = ast_ident(ast_decl(decl)->ident)->name;
+    uint32_t slot = name->hash & mask;
+    while (block->index[slot]) {
+        if (ast_ident(ast_decl(block->index[slot])->ident)->name == name) return; // Redeclared, lookups find the first one.
+        slot = (slot + 1) & mask;
+    }
+    block->index[slot] = decl;
+    block->index_count += 1;
+}
+
+static void block_index_grow(Ast_Block *block)
+{
+    Ast_Handle *old_index = block->index;
+    uint32_t old_capacity = block->index_capacity;
+
+    block->index_capacity = old_capacity ? old_capacity * 2 : 4 * BLOCK_INDEX_THRESHOLD;
+    block->index = calloc(block->index_capacity, sizeof(Ast_Handle));
+    block->index_count = 0;
+    assert(block->index != NULL && "Ran out of memory");
+
+    if (old_index) {
+        for (uint32_t i = 0; i < old_capacity; i++) {
+            if (old_index[i]) block_index_insert_without_growing(block, old_index[i]);
+        }
+        free(old_index);
+    } else {
+        For (block->declarations) {
+            if (ast_decl(block->declarations[it])->ident) block_index_insert_without_growing(block, block->declarations[it]);
+        }
+    }
+}
+
+void block_add_declaration(Ast_Block *block, Ast_Declaration *decl)
 {
-    return parse_binary_expression(p, NULL, 1);
+    arrput(block->declarations, ast_handle(decl));
+
+    if (!block->index) {
+        if (arrlenu(block->declarations) > BLOCK_INDEX_THRESHOLD) block_index_grow(block); // Indexes everything, including decl.
+        return;
+    }
+
+    if (!decl->ident) return;
+
+    // Keep the load factor under a half, like the atom table.
+    if (2*(block->index_count + 1) > block->index_capacity) block_index_grow(block);
+    block_index_insert_without_growing(block, ast_handle(decl));
 }
 
 void checked_add_to_scope(Parser *p, Ast_Block *block, Ast_Declaration *decl)
+{
+    if (block == p->workspace->global_block) {
+        arrput(p->toplevel, ((Toplevel_Entry){ .declaration = decl }));
+        return;
+    }
+    add_to_scope_and_check_redeclaration(p, block, decl);
+}
+
+void add_to_scope_and_check_redeclaration(Parser *p, Ast_Block *block, Ast_Declaration *decl)
 {
     if (decl->ident) {
-        For (block->declarations) {
-            if (!block->declarations[it]->ident) continue;
-            if (sv_eq(block->declarations[it]->ident->name, decl->ident->name)) {
-                parser_report_error(p, decl->ident->_expression.location, "Redeclared identifier '"SV_Fmt"'.", SV_Arg(decl->ident->name));
-                parser_report_error(p, block->declarations[it]->ident->_expression.location, "... the first declaration was here.");
-                // TODO: Print other declaration location.
-            }
+        Ast_Declaration *existing = find_declaration_in_block(block, ast_ident(decl->ident)->name);
+        if (existing) {
+            parser_report_error(p, ast_ident(decl->ident)->_expression.location, "Redeclared identifier '"SV_Fmt"'.", SV_Arg(ast_ident(decl->ident)->name->name));
+            parser_report_error(p, ast_ident(existing->ident)->_expression.location, "... the first declaration was here.");
         }
     }
-    arrput(block->declarations, decl);
+    block_add_declaration(block, decl);
 }
 
-Ast_Declaration *find_declaration_in_block(const Ast_Block *block, String_View name)
+Ast_Declaration *find_declaration_in_block(const Ast_Block *block, const Atom *name)
 {
+    if (block->index) {
+        uint32_t mask = block->index_capacity - 1;
+        for (uint32_t slot = name->hash & mask; block->index[slot]; slot = (slot + 1) & mask) {
+            if (ast_ident(ast_decl(block->index[slot])->ident)->name == name) return ast_decl(block->index[slot]);
+        }
+        return NULL;
+    }
+
     For (block->declarations) {
-        if (!block->declarations[it]->ident) continue;
+        Ast_Declaration *decl = ast_decl(block->declarations[it]);
+        if (!decl->ident) continue;
 
-        if (sv_eq(block->declarations[it]->ident->name, name)) {
-            return block->declarations[it];
+        if (ast_ident(decl->ident)->name == name) {
+            return decl;
         }
     }
     return NULL;
@@ -1430,11 +1769,11 @@ Ast_Declaration *find_declaration_in_block(const Ast_Block *block, String_View n
 
 Ast_Declaration *find_declaration_from_identifier(const Ast_Ident *ident)
 {
-    Ast_Block *block = ident->enclosing_block;
+    Ast_Block *block = ast_block(ident->enclosing_block);
     while (block) {
         Ast_Declaration *decl = find_declaration_in_block(block, ident->name);
         if (decl) return decl;
-        block = block->parent;
+        block = ast_block(block->parent);
     }
     return NULL;
 }
@@ -1504,42 +1843,42 @@ void print_expr_to_builder(String_Builder *sb, const Ast_Expression *expr, size_
     }
     case AST_IDENT: {
         const Ast_Ident *ident = xx expr;
-        sb_append(sb, ident->name.data, ident->name.count);
+        sb_append(sb, ident->name->name.data, ident->name->name.count);
         break;
     }
     case AST_UNARY_OPERATOR: {
         const Ast_Unary_Operator *unary = xx expr;
         sb_append_cstr(sb, token_type_to_string(unary->operator_type));
-        print_expr_to_builder(sb, unary->subexpression, depth);
+        print_expr_to_builder(sb, ast_expr(unary->subexpression), depth);
         break;
     }
     case AST_BINARY_OPERATOR: {
         const Ast_Binary_Operator *binary = xx expr;
-        print_expr_to_builder(sb, binary->left, depth);
+        print_expr_to_builder(sb, ast_expr(binary->left), depth);
         sb_append_cstr(sb, " ");
         sb_append_cstr(sb, token_type_to_string(binary->operator_type));
         sb_append_cstr(sb, " ");
-        print_expr_to_builder(sb, binary->right, depth);
+        print_expr_to_builder(sb, ast_expr(binary->right), depth);
         break;
     }
     case AST_PROCEDURE: {
         const Ast_Procedure *proc = xx expr;
-        print_type_to_builder(sb, proc->lambda_type);
+        print_type_to_builder(sb, ast_type(proc->lambda_type));
         sb_append_cstr(sb, " ");
-        if (proc->body_block) print_stmt_to_builder(sb, xx proc->body_block, depth);
+        if (proc->body_block) print_stmt_to_builder(sb, ast_get(proc->body_block), depth);
         if (proc->foreign_library_name) {
             sb_append_cstr(sb, "#foreign ");
-            sb_append(sb, proc->foreign_library_name->name.data, proc->foreign_library_name->name.count);
+            sb_append(sb, ast_ident(proc->foreign_library_name)->name->name.data, ast_ident(proc->foreign_library_name)->name->name.count);
         }
         break;
     }
     case AST_PROCEDURE_CALL: {
         const Ast_Procedure_Call *call = xx expr;       
-        print_expr_to_builder(sb, call->procedure_expression, depth);
+        print_expr_to_builder(sb, ast_expr(call->procedure_expression), depth);
         sb_append_cstr(sb, "(");
         For (call->arguments) {
             if (it > 0) sb_append_cstr(sb, ", ");
-            print_expr_to_builder(sb, call->arguments[it], depth);
+            print_expr_to_builder(sb, ast_expr(call->arguments[it]), depth);
         }
         sb_append_cstr(sb, ")");
         break;
@@ -1549,26 +1888,26 @@ void print_expr_to_builder(String_Builder *sb, const Ast_Expression *expr, size_
         break;
     case AST_CAST: {
         const Ast_Cast *cast = xx expr;
-        print_type_to_builder(sb, cast->type);
+        print_type_to_builder(sb, ast_type(cast->type));
         sb_append_cstr(sb, " as ");
-        print_expr_to_builder(sb, cast->subexpression, depth);
+        print_expr_to_builder(sb, ast_expr(cast->subexpression), depth);
         break;
     }
     case AST_SELECTOR: {
         const Ast_Selector *selector = xx expr;
-        print_expr_to_builder(sb, selector->namespace_expression, depth);
+        print_expr_to_builder(sb, ast_expr(selector->namespace_expression), depth);
         sb_append_cstr(sb, ".");
-        print_expr_to_builder(sb, xx selector->ident, depth);
+        print_expr_to_builder(sb, ast_get(selector->ident), depth);
         break;
     }
     case AST_TYPE_INSTANTIATION: {
         const Ast_Type_Instantiation *inst = xx expr;
-        print_type_to_builder(sb, inst->type_definition);
+        print_type_to_builder(sb, ast_type(inst->type_definition));
         sb_append_cstr(sb, " {\n");
         depth += 1;
         For (inst->arguments) {
             for (size_t i = 0; i < depth; ++i) sb_append_cstr(sb, "    ");
-            print_expr_to_builder(sb, inst->arguments[it], depth);
+            print_expr_to_builder(sb, ast_expr(inst->arguments[it]), depth);
             sb_append_cstr(sb, ",\n");
         }
         sb_append_cstr(sb, "}");
@@ -1591,10 +1930,10 @@ void print_type_to_builder(String_Builder *sb, const Ast_Type_Definition *defn)
         break;
     case TYPE_DEF_STRUCT:
         sb_append_cstr(sb, "struct { ");
-        For (defn->struct_desc->block->declarations) {
-            if (defn->struct_desc->block->declarations[it]->flags & DECLARATION_IS_CONSTANT) continue;
+        For (ast_block(ast_struct(defn->struct_desc)->block)->declarations) {
+            if (ast_decl(ast_block(ast_struct(defn->struct_desc)->block)->declarations[it])->flags & DECLARATION_IS_CONSTANT) continue;
             if (it > 0) sb_append_cstr(sb, ", ");
-            print_decl_to_builder(sb, defn->struct_desc->block->declarations[it], 0);
+            print_decl_to_builder(sb, ast_decl(ast_block(ast_struct(defn->struct_desc)->block)->declarations[it]), 0);
         }
         sb_append_cstr(sb, " }");
         break;
@@ -1604,12 +1943,12 @@ void print_type_to_builder(String_Builder *sb, const Ast_Type_Definition *defn)
         break;
     case TYPE_DEF_IDENT:
         sb_append_cstr(sb, "`"); // nocheckin: this is so we can see that it's an identifier.
-        sb_append(sb, defn->type_name->name.data, defn->type_name->name.count);
+        sb_append(sb, ast_ident(defn->type_name)->name->name.data, ast_ident(defn->type_name)->name->name.count);
         break;
     case TYPE_DEF_STRUCT_CALL:
     case TYPE_DEF_POINTER:
         sb_append(sb, "*", 1);
-        print_type_to_builder(sb, defn->pointer_to);
+        print_type_to_builder(sb, ast_type(defn->pointer_to));
         break;
     case TYPE_DEF_ARRAY:
         switch (defn->array.kind) {
@@ -1623,16 +1962,16 @@ void print_type_to_builder(String_Builder *sb, const Ast_Type_Definition *defn)
             sb_append_cstr(sb, "[..] ");
             break;
         }
-        print_type_to_builder(sb, defn->array.element_type);
+        print_type_to_builder(sb, ast_type(defn->array.element_type));
         break;
     case TYPE_DEF_LAMBDA:
         sb_append_cstr(sb, "(");
         For (defn->lambda.argument_types) {
             if (it > 0) sb_append_cstr(sb, ", ");
-            print_type_to_builder(sb, defn->lambda.argument_types[it]);
+            print_type_to_builder(sb, ast_type(defn->lambda.argument_types[it]));
         }
         sb_append_cstr(sb, ") -> ");
-        print_type_to_builder(sb, defn->lambda.return_type);
+        print_type_to_builder(sb, ast_type(defn->lambda.return_type));
         break;
     }
 }
@@ -1646,7 +1985,7 @@ void print_stmt_to_builder(String_Builder *sb, const Ast_Statement *stmt, size_t
         sb_append_cstr(sb, "{\n");
         For (block->statements) {
             for (size_t i = 0; i < depth; ++i) sb_append_cstr(sb, "    ");
-            print_stmt_to_builder(sb, block->statements[it], depth);
+            print_stmt_to_builder(sb, ast_stmt(block->statements[it]), depth);
             sb_append_cstr(sb, "\n");
         }
         sb_append_cstr(sb, "}");
@@ -1655,29 +1994,29 @@ void print_stmt_to_builder(String_Builder *sb, const Ast_Statement *stmt, size_t
     case AST_WHILE: {
         const Ast_While *while_stmt = xx stmt;
         sb_append_cstr(sb, "while ");
-        print_expr_to_builder(sb, while_stmt->condition_expression, depth);
+        print_expr_to_builder(sb, ast_expr(while_stmt->condition_expression), depth);
         sb_append_cstr(sb, " ");
-        print_stmt_to_builder(sb, while_stmt->then_statement, depth);
+        print_stmt_to_builder(sb, ast_stmt(while_stmt->then_statement), depth);
         break;
     }
     case AST_IF: {
         const Ast_If *if_stmt = xx stmt;
         sb_append_cstr(sb, "if ");
-        print_expr_to_builder(sb, if_stmt->condition_expression, depth);
+        print_expr_to_builder(sb, ast_expr(if_stmt->condition_expression), depth);
         sb_append_cstr(sb, " ");
-        print_stmt_to_builder(sb, if_stmt->then_statement, depth);
+        print_stmt_to_builder(sb, ast_stmt(if_stmt->then_statement), depth);
         if (if_stmt->else_statement) {
             sb_append_cstr(sb, " else ");
-            print_stmt_to_builder(sb, if_stmt->else_statement, depth);
+            print_stmt_to_builder(sb, ast_stmt(if_stmt->else_statement), depth);
         }
         break;
     }
     case AST_FOR: {
         const Ast_For *for_stmt = xx stmt;
         sb_append_cstr(sb, "for ");
-        print_expr_to_builder(sb, for_stmt->range_expression, depth);
+        print_expr_to_builder(sb, ast_expr(for_stmt->range_expression), depth);
         sb_append_cstr(sb, " ");
-        print_stmt_to_builder(sb, for_stmt->then_statement, depth);
+        print_stmt_to_builder(sb, ast_stmt(for_stmt->then_statement), depth);
         break;
     }
     case AST_LOOP_CONTROL: {
@@ -1688,13 +2027,13 @@ void print_stmt_to_builder(String_Builder *sb, const Ast_Statement *stmt, size_t
     case AST_RETURN: {
         const Ast_Return *ret = xx stmt;
         sb_append_cstr(sb, "return ");
-        print_expr_to_builder(sb, ret->subexpression, depth);
+        print_expr_to_builder(sb, ast_expr(ret->subexpression), depth);
         break;
     }
     case AST_USING: {
         const Ast_Using *using = xx stmt;
         sb_append_cstr(sb, "using ");
-        print_expr_to_builder(sb, using->subexpression, depth);
+        print_expr_to_builder(sb, ast_expr(using->subexpression), depth);
         break;
     }
     case AST_IMPORT: {
@@ -1706,19 +2045,19 @@ void print_stmt_to_builder(String_Builder *sb, const Ast_Statement *stmt, size_t
     }
     case AST_EXPRESSION_STATEMENT: {
         Ast_Expression_Statement *expr = xx stmt;
-        print_expr_to_builder(sb, expr->subexpression, depth);
+        print_expr_to_builder(sb, ast_expr(expr->subexpression), depth);
         break;
     }
     case AST_VARIABLE: {
         Ast_Variable *var = xx stmt;
-        print_decl_to_builder(sb, var->declaration, depth);
+        print_decl_to_builder(sb, ast_decl(var->declaration), depth);
         break;
     }
     case AST_ASSIGNMENT: {
         Ast_Assignment *assign = xx stmt;
-        print_expr_to_builder(sb, assign->pointer, depth);
+        print_expr_to_builder(sb, ast_expr(assign->pointer), depth);
         sb_append_cstr(sb, " = ");
-        print_expr_to_builder(sb, assign->value, depth);
+        print_expr_to_builder(sb, ast_expr(assign->value), depth);
         break;
     }
     }
@@ -1726,19 +2065,19 @@ void print_stmt_to_builder(String_Builder *sb, const Ast_Statement *stmt, size_t
 
 void print_decl_to_builder(String_Builder *sb, const Ast_Declaration *decl, size_t depth)
 {
-    if (decl->ident) sb_append(sb, decl->ident->name.data, decl->ident->name.count);
+    if (decl->ident) sb_append(sb, ast_ident(decl->ident)->name->name.data, ast_ident(decl->ident)->name->name.count);
     else sb_append_cstr(sb, "<unnamed>");
 
     sb_append_cstr(sb, " :");
     if (decl->my_type) {
         sb_append_cstr(sb, " ");
-        sb_append_cstr(sb, type_to_string(decl->my_type));
+        sb_append_cstr(sb, type_to_string(ast_type(decl->my_type)));
         sb_append_cstr(sb, " ");
     }
     if (decl->my_value) {
         if (decl->flags & DECLARATION_IS_CONSTANT) sb_append_cstr(sb, ": ");
         else sb_append_cstr(sb, "= ");
-        print_expr_to_builder(sb, decl->my_value, depth);
+        print_expr_to_builder(sb, ast_expr(decl->my_value), depth);
     }
 }
 
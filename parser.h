@@ -1,5 +1,6 @@
 #pragma once
 
+#include <assert.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -43,6 +44,18 @@ typedef struct Ast_Enum Ast_Enum;
 typedef struct Ast_Type_Definition Ast_Type_Definition;
 typedef struct Ast_Declaration Ast_Declaration;
 
+// Nodes don't point at each other, they refer to each other with 32-bit handles. The top bits of a
+// handle say which pool the node is in, the rest is its index in that pool. 0 is no node.
+// See ast_get() and ast_handle().
+typedef uint32_t Ast_Handle;
+
+// Every distinct identifier name is interned once per workspace (see workspace_intern()), so two
+// names are equal exactly when their atoms are the same pointer.
+typedef struct {
+    String_View name; // Null-terminated, so name.data can be handed straight to LLVM.
+    uint32_t hash; // hash_identifier() of name.
+} Atom;
+
 typedef enum {
     AST_NUMBER = 1,
     AST_LITERAL = 2,
@@ -63,24 +76,36 @@ struct Ast_Expression {
     Source_Location location;
 
     // @Volatile: Both of these are set during type-checking.
-    Ast_Type_Definition *inferred_type;
+    Ast_Handle inferred_type; // Ast_Type_Definition
     // Ast_Expression *replacement;
 };
 
+// @Volatile: Statement kinds don't overlap with expression kinds, so ast_alloc() can pick a pool by kind alone.
 typedef enum {
-    AST_BLOCK = 1,
-    AST_WHILE = 2,
-    AST_IF = 3,
-    AST_FOR = 4,
-    AST_LOOP_CONTROL = 5,
-    AST_RETURN = 6,
-    AST_USING = 7,
-    AST_IMPORT = 8,
-    AST_EXPRESSION_STATEMENT = 9, // When an expression is used as a statement...
-    AST_VARIABLE = 10,
-    AST_ASSIGNMENT = 11,
+    AST_BLOCK = 17,
+    AST_WHILE = 18,
+    AST_IF = 19,
+    AST_FOR = 20,
+    AST_LOOP_CONTROL = 21,
+    AST_RETURN = 22,
+    AST_USING = 23,
+    AST_IMPORT = 24,
+    AST_EXPRESSION_STATEMENT = 25, // When an expression is used as a statement...
+    AST_VARIABLE = 26,
+    AST_ASSIGNMENT = 27,
 } Ast_Statement_Kind;
 
+// Every node kind has its own pool, and declarations and the struct and enum descriptors get one
+// each after the statement kinds. Pool 0 is never used, so no handle is 0.
+enum {
+    AST_POOL_DECLARATION = 28,
+    AST_POOL_STRUCT = 29,
+    AST_POOL_ENUM = 30,
+};
+
+#define AST_POOL_COUNT 32
+#define AST_HANDLE_INDEX_BITS 27 // The other 5 bits pick the pool.
+
 struct Ast_Statement {
     // @Volatile: These first 3 fields must be the same as Ast_Expression because of ast_alloc().
     Ast_Statement_Kind kind;
@@ -102,15 +127,23 @@ typedef enum {
 struct Ast_Block {
     Ast_Statement _statement;
 
-    Ast_Block *parent;
+    Ast_Handle parent; // Ast_Block
 
     Ast_Block_Kind belongs_to;
-    void *belongs_to_data;
+    Ast_Handle belongs_to_data; // Ast_Procedure, Ast_Struct or Ast_Enum.
 
-    Ast_Statement **statements; // @malloced with stb_ds
-    Ast_Declaration **declarations; // @malloced with stb_ds
+    Ast_Handle *statements; // Ast_Statement. @malloced with stb_ds
+    Ast_Handle *declarations; // Ast_Declaration. @malloced with stb_ds
+
+    // Only built once a block has more than BLOCK_INDEX_THRESHOLD declarations, small blocks are just scanned.
+    // Open addressing with linear probing, keyed by the identifier's atom. Holds the first declaration of each name.
+    Ast_Handle *index; // Ast_Declaration. @malloced
+    uint32_t index_capacity; // Zero or a power of two.
+    uint32_t index_count;
 };
 
+#define BLOCK_INDEX_THRESHOLD 16
+
 // BEGIN EXPRESSIONS
 
 // This is technically a literal, but it's so common that we want to check if a literal is a number,
@@ -146,34 +179,36 @@ typedef struct {
 typedef struct {
     Ast_Expression _expression;
 
-    String_View name;
-    Ast_Block *enclosing_block;
+    Atom *name;
+    Ast_Handle enclosing_block; // Ast_Block
 
-    Ast_Declaration *resolved_declaration; // @Volatile: Set during typechecking.
+    Ast_Handle resolved_declaration; // Ast_Declaration. @Volatile: Set during typechecking.
 } Ast_Ident;
 
 typedef struct {
     Ast_Expression _expression;
 
     int operator_type;
-    Ast_Expression *subexpression;
+    Ast_Handle subexpression; // Ast_Expression
 } Ast_Unary_Operator;
 
 typedef struct {
     Ast_Expression _expression;
 
     int operator_type;
-    Ast_Expression *left;
-    Ast_Expression *right;
+    Ast_Handle left; // Ast_Expression
+    Ast_Handle right; // Ast_Expression
 } Ast_Binary_Operator;
 
 typedef struct {
     Ast_Expression _expression;
 
-    Ast_Type_Definition *lambda_type;
-    Ast_Block *body_block; // This will be NULL if we are foreign.
+    Ast_Handle lambda_type; // Ast_Type_Definition
+    Ast_Handle body_block; // Ast_Block. This will be 0 if we are foreign, or if the body was skipped and nobody asked for it yet.
+    bool body_is_skipped; // Only the braces were matched, see parse_skipped_procedure_body(). Stays set after it is parsed.
+    _Atomic bool body_is_claimed; // Someone is parsing the skipped body, see workspace_parse_procedure_body(). Set under Workspace.typecheck_mutex.
     
-    Ast_Ident *foreign_library_name;
+    Ast_Handle foreign_library_name; // Ast_Ident
 
     LLVMValueRef llvm_value;
 } Ast_Procedure;
@@ -182,10 +217,10 @@ typedef struct {
 struct Ast_Lambda_ {
     Ast_Expression _expression;
 
-    Ast_Type_Definition *type_definition;
-    Ast_Declaration *my_body_declaration;
+    Ast_Handle type_definition; // Ast_Type_Definition
+    Ast_Handle my_body_declaration; // Ast_Declaration
 
-    Ast_Ident *foreign_library_name; // If this is non-null, we are a foreign procedure.
+    Ast_Handle foreign_library_name; // Ast_Ident. If this is set, we are a foreign procedure.
 
     // String_View name;
     // Ast_Block *block; // block->parent == arguments_block
@@ -194,19 +229,19 @@ struct Ast_Lambda_ {
 typedef struct {
     Ast_Expression _expression;
 
-    Ast_Expression *procedure_expression;
-    Ast_Expression **arguments; // @malloced with stb_ds
+    Ast_Handle procedure_expression; // Ast_Expression
+    Ast_Handle *arguments; // Ast_Expression. @malloced with stb_ds
 } Ast_Procedure_Call;
 
 struct Ast_Struct {
-    Ast_Block *block;
+    Ast_Handle block; // Ast_Block
     int field_count;
-    Ast_Type_Definition **field_types; // @Volatile: Set after this struct has been typechecked.
+    Ast_Handle *field_types; // Ast_Type_Definition. @Volatile: Set after this struct has been typechecked.
 };
 
 struct Ast_Enum {
-    Ast_Type_Definition *underlying_int_type;
-    Ast_Block *block;
+    Ast_Handle underlying_int_type; // Ast_Type_Definition
+    Ast_Handle block; // Ast_Block
 };
 
 typedef enum {
@@ -234,26 +269,26 @@ struct Ast_Type_Definition {
     const char *name; // May be NULL. For literals this is the name of the type like "int" or "float".
 
     union {
-        Ast_Struct *struct_desc;
-        Ast_Enum *enum_defn;
-        Ast_Ident *type_name;
-        Ast_Procedure_Call *struct_call;
-        Ast_Type_Definition *pointer_to;
+        Ast_Handle struct_desc; // Ast_Struct
+        Ast_Handle enum_defn; // Ast_Enum
+        Ast_Handle type_name; // Ast_Ident
+        Ast_Handle struct_call; // Ast_Procedure_Call
+        Ast_Handle pointer_to; // Ast_Type_Definition
         Literal_Kind literal;
         struct {
             unsigned long flags;
-            Ast_Number *literal_low;
-            Ast_Number *literal_high;
+            Ast_Handle literal_low; // Ast_Number
+            Ast_Handle literal_high; // Ast_Number
         } number;
         struct {
             long long length;
-            Ast_Type_Definition *element_type;
+            Ast_Handle element_type; // Ast_Type_Definition
             Type_Def_Array_Kind kind;
         } array;
         struct {
-            Ast_Block *arguments_block;
-            Ast_Type_Definition *return_type;
-            Ast_Type_Definition **argument_types; // Pointers to the lambda's argument declarations, not copies.
+            Ast_Handle arguments_block; // Ast_Block
+            Ast_Handle return_type; // Ast_Type_Definition
+            Ast_Handle *argument_types; // Ast_Type_Definition. The types of the lambda's argument declarations, not copies.
             bool variadic;
         } lambda;
     };
@@ -265,16 +300,16 @@ struct Ast_Type_Definition {
 typedef struct {
     Ast_Expression _expression;
 
-    Ast_Type_Definition *type;
-    Ast_Expression *subexpression;
+    Ast_Handle type; // Ast_Type_Definition
+    Ast_Handle subexpression; // Ast_Expression
     bool value_cast; // Try and retain the same value or panic.
 } Ast_Cast;
 
 typedef struct {
     Ast_Expression _expression;
 
-    Ast_Expression *namespace_expression;
-    Ast_Ident *ident; // The identifier we are looking up.
+    Ast_Handle namespace_expression; // Ast_Expression
+    Ast_Handle ident; // Ast_Ident. The identifier we are looking up.
     // Ast_Declaration *resolved_declaration;
     int struct_field_index;
 } Ast_Selector;
@@ -282,8 +317,8 @@ typedef struct {
 typedef struct {
     Ast_Expression _expression;
 
-    Ast_Type_Definition *type_definition;
-    Ast_Expression **arguments;
+    Ast_Handle type_definition; // Ast_Type_Definition
+    Ast_Handle *arguments; // Ast_Expression
 } Ast_Type_Instantiation;
 
 // BEGIN STATEMENTS
@@ -291,25 +326,25 @@ typedef struct {
 typedef struct {
     Ast_Statement _statement;
 
-    Ast_Expression *condition_expression;
-    Ast_Statement *then_statement;
+    Ast_Handle condition_expression; // Ast_Expression
+    Ast_Handle then_statement; // Ast_Statement
 } Ast_While;
 
 typedef struct {
     Ast_Statement _statement;
 
     bool directive;
-    Ast_Expression *condition_expression;
-    Ast_Statement *then_statement;
-    Ast_Statement *else_statement;
+    Ast_Handle condition_expression; // Ast_Expression
+    Ast_Handle then_statement; // Ast_Statement
+    Ast_Handle else_statement; // Ast_Statement
 } Ast_If;
 
 typedef struct {
     Ast_Statement _statement;
 
-    Ast_Expression *range_expression;
-    Ast_Statement *then_statement;
-    Ast_Declaration *iterator_declaration;
+    Ast_Handle range_expression; // Ast_Expression
+    Ast_Handle then_statement; // Ast_Statement
+    Ast_Handle iterator_declaration; // Ast_Declaration
 } Ast_For;
 
 typedef struct {
@@ -321,14 +356,14 @@ typedef struct {
 typedef struct {
     Ast_Statement _statement;
 
-    Ast_Expression *subexpression;
-    Ast_Procedure *proc_i_belong_to;
+    Ast_Handle subexpression; // Ast_Expression
+    Ast_Handle proc_i_belong_to; // Ast_Procedure
 } Ast_Return;
 
 typedef struct {
     Ast_Statement _statement;
 
-    Ast_Expression *subexpression;
+    Ast_Handle subexpression; // Ast_Expression
 } Ast_Using;
 
 // enum {
@@ -349,21 +384,21 @@ typedef struct {
 typedef struct {
     Ast_Statement _statement;
 
-    Ast_Expression *subexpression;
+    Ast_Handle subexpression; // Ast_Expression
 } Ast_Expression_Statement;
 
 typedef struct {
     Ast_Statement _statement;
 
-    Ast_Declaration *declaration;
+    Ast_Handle declaration; // Ast_Declaration
     int lambda_argument_index; // -1 when not a lambda argument.
 } Ast_Variable;
 
 typedef struct {
     Ast_Statement _statement;
     
-    Ast_Expression *pointer; // a.b.c
-    Ast_Expression *value;
+    Ast_Handle pointer; // Ast_Expression. a.b.c
+    Ast_Handle value; // Ast_Expression
 } Ast_Assignment;
 
 typedef struct {
@@ -388,66 +423,235 @@ enum {
     DECLARATION_VALUE_WAS_INFERRED_FROM_TYPE = 0x100, // Default value (zero) was added.
     DECLARATION_HAS_BEEN_TYPECHECKED = 0x200,
     DECLARATION_IS_FOREIGN = 0x400,
+    DECLARATION_SIGNATURE_IS_TYPECHECKED = 0x1000, // A procedure's argument and return types are final, its body may not be.
 };
 
 // This is so we can store a flattened list of nodes for typechecking.
 struct Ast_Node {
-    Ast_Expression **expression;
-    Ast_Statement *statement;
+    Ast_Handle *expression; // Ast_Expression
+    Ast_Handle statement; // Ast_Statement
 };
 
 struct Ast_Declaration {
     Source_Location location;
     size_t serial;
-    Ast_Ident *ident;
+    Ast_Handle ident; // Ast_Ident
 
-    Ast_Type_Definition *my_type;
-    Ast_Expression *my_value;
-    Ast_Block *my_block; // If this declaration owns a block.
-    Ast_Import *my_import; // If this declaration is an import.
+    Ast_Handle my_type; // Ast_Type_Definition
+    Ast_Handle my_value; // Ast_Expression
+    Ast_Handle my_block; // Ast_Block. If this declaration owns a block.
+    Ast_Handle my_import; // Ast_Import. If this declaration is an import.
 
     int struct_field_index; // If a struct member.
 
     Ast_Node *flattened;
     size_t typechecking_position;
+    Ast_Declaration *blocked_on; // What typechecking us is waiting for, see workspace_typecheck().
+    bool blocked_on_signature; // We only need blocked_on's signature, not all of it.
+    Ast_Declaration **waiting; // Declarations blocked on us, they get queued again once we are typechecked. @malloced with stb_ds
+    // Guarded by Workspace.typecheck_mutex:
+    bool is_being_typechecked; // Then only the thread typechecking us may touch flattened.
+    bool body_is_unflattened; // Our procedure's body got parsed while is_being_typechecked, the scheduler flattens it afterwards.
 
     LLVMValueRef llvm_value; // @Cleanup
 
-    unsigned int flags;
+    _Atomic unsigned int flags; // Atomic because other threads check DECLARATION_HAS_BEEN_TYPECHECKED while we typecheck.
 };
 
+// BEGIN POOLS
+
+// Every pool gets AST_POOL_RESERVE bytes of one big reservation of address space, which is only
+// backed by memory as nodes get allocated. So nodes never move, they start out zeroed, and a
+// handle is turned into an address with just the size of its pool's nodes. See ast_pools_init().
+// There is one set of pools for the whole program, which is fine while there is one workspace.
+#define AST_POOL_RESERVE_BITS 32
+#define AST_POOL_RESERVE ((size_t)1 << AST_POOL_RESERVE_BITS)
+
+extern char *ast_pool_memory;
+
+static const uint32_t ast_node_sizes[AST_POOL_COUNT] = {
+    [AST_NUMBER]               = sizeof(Ast_Number),
+    [AST_LITERAL]              = sizeof(Ast_Literal),
+    [AST_IDENT]                = sizeof(Ast_Ident),
+    [AST_UNARY_OPERATOR]       = sizeof(Ast_Unary_Operator),
+    [AST_BINARY_OPERATOR]      = sizeof(Ast_Binary_Operator),
+    [AST_PROCEDURE]            = sizeof(Ast_Procedure),
+    [AST_PROCEDURE_CALL]       = sizeof(Ast_Procedure_Call),
+    [AST_TYPE_DEFINITION]      = sizeof(Ast_Type_Definition),
+    [AST_CAST]                 = sizeof(Ast_Cast),
+    [AST_SELECTOR]             = sizeof(Ast_Selector),
+    [AST_TYPE_INSTANTIATION]   = sizeof(Ast_Type_Instantiation),
+    [AST_BLOCK]                = sizeof(Ast_Block),
+    [AST_WHILE]                = sizeof(Ast_While),
+    [AST_IF]                   = sizeof(Ast_If),
+    [AST_FOR]                  = sizeof(Ast_For),
+    [AST_LOOP_CONTROL]         = sizeof(Ast_Loop_Control),
+    [AST_RETURN]               = sizeof(Ast_Return),
+    [AST_USING]                = sizeof(Ast_Using),
+    [AST_IMPORT]               = sizeof(Ast_Import),
+    [AST_EXPRESSION_STATEMENT] = sizeof(Ast_Expression_Statement),
+    [AST_VARIABLE]             = sizeof(Ast_Variable),
+    [AST_ASSIGNMENT]           = sizeof(Ast_Assignment),
+    [AST_POOL_DECLARATION]     = sizeof(Ast_Declaration),
+    [AST_POOL_STRUCT]          = sizeof(Ast_Struct),
+    [AST_POOL_ENUM]            = sizeof(Ast_Enum),
+};
+
+void ast_pools_init(void);
+void ast_pools_reset(void); // Throws away every node, for the benchmark.
+size_t ast_pools_bytes_used(void);
+void *ast_pool_alloc(unsigned int pool);
+void *ast_alloc(Source_Location loc, unsigned int kind);
+uint32_t ast_pool_count(unsigned int pool); // Nodes in the pool have the indices below this.
+
+static inline unsigned int ast_pool_of(Ast_Handle handle)
+{
+    return handle >> AST_HANDLE_INDEX_BITS;
+}
+
+static inline Ast_Handle ast_pool_handle(unsigned int pool, uint32_t index)
+{
+    return (Ast_Handle)pool << AST_HANDLE_INDEX_BITS | index;
+}
+
+static inline void *ast_get(Ast_Handle handle)
+{
+    if (!handle) return NULL;
+    unsigned int pool = ast_pool_of(handle);
+    size_t index = handle & ((1u << AST_HANDLE_INDEX_BITS) - 1);
+    return ast_pool_memory + ((size_t)pool << AST_POOL_RESERVE_BITS) + index * ast_node_sizes[pool];
+}
+
+static inline Ast_Handle ast_handle(const void *node)
+{
+    if (!node) return 0;
+    size_t offset = (size_t)((const char *)node - ast_pool_memory);
+    unsigned int pool = (unsigned int)(offset >> AST_POOL_RESERVE_BITS);
+    assert(pool > 0 && pool < AST_POOL_COUNT && ast_node_sizes[pool] && "Not a node in one of the pools");
+    return ast_pool_handle(pool, (uint32_t)offset / ast_node_sizes[pool]); // The offset into the pool is in the low bits.
+}
+
+// These are ast_get() for the handles we follow the most, and they check the pool.
+
+static inline Ast_Expression *ast_expr(Ast_Handle handle)
+{
+    assert(ast_pool_of(handle) <= AST_TYPE_INSTANTIATION);
+    return ast_get(handle);
+}
+
+static inline Ast_Statement *ast_stmt(Ast_Handle handle)
+{
+    assert(!handle || (ast_pool_of(handle) >= AST_BLOCK && ast_pool_of(handle) <= AST_ASSIGNMENT));
+    return ast_get(handle);
+}
+
+static inline Ast_Type_Definition *ast_type(Ast_Handle handle)
+{
+    assert(!handle || ast_pool_of(handle) == AST_TYPE_DEFINITION);
+    return ast_get(handle);
+}
+
+static inline Ast_Block *ast_block(Ast_Handle handle)
+{
+    assert(!handle || ast_pool_of(handle) == AST_BLOCK);
+    return ast_get(handle);
+}
+
+static inline Ast_Ident *ast_ident(Ast_Handle handle)
+{
+    assert(!handle || ast_pool_of(handle) == AST_IDENT);
+    return ast_get(handle);
+}
+
+static inline Ast_Declaration *ast_decl(Ast_Handle handle)
+{
+    assert(!handle || ast_pool_of(handle) == AST_POOL_DECLARATION);
+    return ast_get(handle);
+}
+
+// The type an expression was typechecked to.
+static inline Ast_Type_Definition *ast_type_of(Ast_Handle expr)
+{
+    return ast_type(ast_expr(expr)->inferred_type);
+}
+
+static inline Ast_Struct *ast_struct(Ast_Handle handle)
+{
+    assert(!handle || ast_pool_of(handle) == AST_POOL_STRUCT);
+    return ast_get(handle);
+}
+
+static inline Ast_Enum *ast_enum(Ast_Handle handle)
+{
+    assert(!handle || ast_pool_of(handle) == AST_POOL_ENUM);
+    return ast_get(handle);
+}
+
+// How many nodes a pool has handed out, the handles of its nodes are ast_pool_handle(pool, index)
+// for every index below that. A pool can be walked like this while nothing allocates from it.
+uint32_t ast_pool_count(unsigned int pool);
+
 // BEGIN PARSER
 // ^ this is so I can search to jump here
 
 #define PARSER_PEEK_CAPACITY 4
 
+// Files are parsed in parallel, so a parser doesn't add top-level declarations to the global block
+// itself. It lists them in source order along with the places where it #load'ed other files, and
+// the workspace merges everything once all files are parsed. See workspace_merge_parsed_file().
+typedef struct {
+    Ast_Declaration *declaration; // NULL for a #load.
+    int loaded_file_index;
+    size_t declaration_count; // How many of the parser's declarations came before the #load.
+} Toplevel_Entry;
+
 typedef struct {
     Arena *arena;
     bool reported_error;
+    bool errors_are_silent; // Only set reported_error, for lexers of a Token_Chunk.
 
     // Stuff for lexing:
 
     int file_index;
 
-    String_View current_input;
-    String_View current_line;
-    const char *current_line_start;
-    int current_line_number;
+    const char *input_begin;
+    const char *cursor; // Walks the entire file buffer, we never split it into lines.
+    const char *input_end;
+    Source_Stream *stream; // Set while the rest of the file still has to be read, see parser_read_more_input().
 
     Token peek_buffer[PARSER_PEEK_CAPACITY];
     size_t peek_begin;
     size_t peek_count;
 
+    // If this is set the file was lexed up front, and we walk it with token_cursor instead of using
+    // the peek buffer. See parser_tokenize_entire_file().
+    Token_Stream *token_stream;
+    size_t token_cursor;
+
     // Stuff for parsing:
 
     Workspace *workspace;
     Ast_Block *current_block;
     Ast_Procedure *current_procedure;
+    bool procedure_body_may_be_skipped; // Set while parsing the value of a constant declaration, if Workspace.lazy_bodies.
+    Ast_Procedure *skipped_procedure; // The body skipped while parsing that value.
     Ast_Statement *current_loop; // Points at either Ast_While or Ast_For.
     size_t serial;
+
+    // Operators parse_expression() has seen but not finished yet: Ast_Binary_Operator without its
+    // right operand, Ast_Unary_Operator without its subexpression, or NULL for an open parenthesis.
+    Ast_Expression **operator_stack; // @malloced with stb_ds
+
+    Toplevel_Entry *toplevel; // @malloced with stb_ds
+    Ast_Declaration **declarations; // Every declaration made in this file. @malloced with stb_ds
 } Parser;
 
-void *ast_alloc(Parser *p, Source_Location loc, unsigned int type, size_t size);
+// A piece of a big file that gets lexed on its own thread, see parser_split_into_token_chunks().
+typedef struct {
+    Parser *lexer; // Walks just this piece of the file.
+    Token_Stream stream;
+    Arena arena; // String literals with escapes get decoded in here, it lives as long as the tokens.
+} Token_Chunk;
 
 // Debugging:
 
@@ -462,6 +666,12 @@ void print_decl_to_builder(String_Builder *sb, const Ast_Declaration *decl, size
 // Lexing:
 
 Parser *parser_init(Workspace *w, int file_index);
+void parser_tokenize_entire_file(Parser *parser);
+size_t parser_split_into_token_chunks(Parser *parser, size_t chunk_count, Token_Chunk **chunks);
+void token_chunk_lex(Token_Chunk *chunk);
+bool parser_join_token_chunks(Parser *parser, Token_Chunk *chunks, size_t chunk_count);
+void parser_free(Parser *parser);
+Token find_next_token(Parser *parser); // Lexes the next token from the input, without the peek buffer or token stream. The parser only uses it through those.
 Token parser_fill_peek_buffer(Parser *parser);
 Token peek_token(Parser *parser, size_t user_index);
 Token peek_next_token(Parser *parser);
@@ -474,15 +684,15 @@ void parser_report_error(Parser *parser, Source_Location loc, const char *format
 
 // Parsing:
 
-Ast_Expression *parse_binary_expression(Parser *p, Ast_Expression *left, int precedence);
-Ast_Expression *parse_unary_expression(Parser *p);
 Ast_Expression *parse_primary_expression(Parser *p, Ast_Expression *base);
 Ast_Expression *parse_base_expression(Parser *p);
 Ast_Expression *parse_expression(Parser *p);
 
 Ast_Type_Definition *parse_lambda_type(Parser *p);
 Ast_Declaration *parse_lambda_argument(Parser *p, unsigned index);
-Ast_Procedure *parse_procedure(Parser *p, Ast_Type_Definition *lambda_type);
+Ast_Procedure *parse_procedure(Parser *p, Ast_Type_Definition *lambda_type, bool skip_body);
+void parse_procedure_body(Parser *p, Ast_Procedure *proc);
+Parser *parse_skipped_procedure_body(Workspace *w, Ast_Procedure *proc);
 
 Ast_Type_Definition *parse_struct_desc(Parser *p);
 Ast_Type_Definition *parse_enum_defn(Parser *p);
@@ -502,9 +712,11 @@ Ast_Statement *parse_statement(Parser *p);
 
 void parse_toplevel(Parser *p);
 
-Ast_Declaration *find_declaration_in_block(const Ast_Block *block, String_View name);
+Ast_Declaration *find_declaration_in_block(const Ast_Block *block, const Atom *name);
 Ast_Declaration *find_declaration_from_identifier(const Ast_Ident *ident);
 void checked_add_to_scope(Parser *p, Ast_Block *block, Ast_Declaration *decl);
+void add_to_scope_and_check_redeclaration(Parser *p, Ast_Block *block, Ast_Declaration *decl);
+void block_add_declaration(Ast_Block *block, Ast_Declaration *decl);
 
 // File and path-related functions:
 
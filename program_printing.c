@@ -109,7 +109,7 @@ const char *ast_to_string(const Ast *ast)
             UNREACHABLE;
         }
 
-        case AST_IDENT: return tprint(SV_Fmt, SV_Arg(((const Ast_Ident *)ast)->name));
+        case AST_IDENT: return tprint(SV_Fmt, SV_Arg(((const Ast_Ident *)ast)->name->name));
 
         case AST_BINARY_OPERATOR: {
             const Ast_Binary_Operator *bin = xx ast;
@@ -0,0 +1,149 @@
+#define _DEFAULT_SOURCE // sysconf
+#include <assert.h>
+#include <string.h> // memset
+
+#ifndef _WIN32
+#    include <unistd.h>
+#endif
+
+#include "common.h"
+#include "thread_pool.h"
+
+#ifndef _WIN32
+
+inline void mutex_init(Mutex *mutex)    { pthread_mutex_init(mutex, NULL); }
+inline void mutex_lock(Mutex *mutex)    { pthread_mutex_lock(mutex); }
+inline void mutex_unlock(Mutex *mutex)  { pthread_mutex_unlock(mutex); }
+inline void mutex_destroy(Mutex *mutex) { pthread_mutex_destroy(mutex); }
+
+int os_processor_count(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
+
+static bool has_pending_jobs(const Thread_Pool *pool)
+{
+    return pool->first_job < arrlenu(pool->jobs);
+}
+
+static void *worker_main(void *data)
+{
+    Thread_Pool *pool = data;
+
+    mutex_lock(&pool->mutex);
+    while (true) {
+        while (!has_pending_jobs(pool) && !pool->quit) pthread_cond_wait(&pool->job_added, &pool->mutex);
+        if (!has_pending_jobs(pool)) break; // Quitting.
+
+        Job job = pool->jobs[pool->first_job];
+        pool->first_job += 1;
+        if (!has_pending_jobs(pool)) {
+            arrdeln(pool->jobs, 0, pool->first_job);
+            pool->first_job = 0;
+        }
+        pool->busy_count += 1;
+        mutex_unlock(&pool->mutex);
+
+        job.proc(job.data);
+
+        mutex_lock(&pool->mutex);
+        pool->busy_count -= 1;
+        if (!has_pending_jobs(pool) && pool->busy_count == 0) pthread_cond_broadcast(&pool->job_done);
+    }
+    mutex_unlock(&pool->mutex);
+
+    // Every thread has its own temporary arena, see common.h.
+    arena_free(&temporary_arena);
+    return NULL;
+}
+
+void thread_pool_init(Thread_Pool *pool, int thread_count)
+{
+    memset(pool, 0, sizeof(*pool));
+    mutex_init(&pool->mutex);
+    pthread_cond_init(&pool->job_added, NULL);
+    pthread_cond_init(&pool->job_done, NULL);
+
+    if (thread_count <= 0) thread_count = os_processor_count();
+
+    for (int i = 0; i < thread_count; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker_main, pool) != 0) break;
+        arrput(pool->threads, thread);
+    }
+    assert(arrlen(pool->threads) > 0 && "Could not start any worker threads");
+}
+
+void thread_pool_add_job(Thread_Pool *pool, Job_Proc proc, void *data)
+{
+    mutex_lock(&pool->mutex);
+    arrput(pool->jobs, ((Job){ proc, data }));
+    pthread_cond_signal(&pool->job_added);
+    mutex_unlock(&pool->mutex);
+}
+
+void thread_pool_wait(Thread_Pool *pool)
+{
+    mutex_lock(&pool->mutex);
+    while (has_pending_jobs(pool) || pool->busy_count > 0) pthread_cond_wait(&pool->job_done, &pool->mutex);
+    mutex_unlock(&pool->mutex);
+}
+
+void thread_pool_free(Thread_Pool *pool)
+{
+    mutex_lock(&pool->mutex);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->job_added);
+    mutex_unlock(&pool->mutex);
+
+    For (pool->threads) pthread_join(pool->threads[it], NULL);
+
+    arrfree(pool->threads);
+    arrfree(pool->jobs);
+    pthread_cond_destroy(&pool->job_added);
+    pthread_cond_destroy(&pool->job_done);
+    mutex_destroy(&pool->mutex);
+}
+
+#else // _WIN32
+
+inline void mutex_init(Mutex *mutex)    { UNUSED(mutex); }
+inline void mutex_lock(Mutex *mutex)    { UNUSED(mutex); }
+inline void mutex_unlock(Mutex *mutex)  { UNUSED(mutex); }
+inline void mutex_destroy(Mutex *mutex) { UNUSED(mutex); }
+
+int os_processor_count(void)
+{
+    return 1;
+}
+
+void thread_pool_init(Thread_Pool *pool, int thread_count)
+{
+    UNUSED(thread_count);
+    memset(pool, 0, sizeof(*pool));
+}
+
+void thread_pool_add_job(Thread_Pool *pool, Job_Proc proc, void *data)
+{
+    arrput(pool->jobs, ((Job){ proc, data }));
+}
+
+void thread_pool_wait(Thread_Pool *pool)
+{
+    // Jobs can add more jobs, so don't hold on to a pointer into the array.
+    while (pool->first_job < arrlenu(pool->jobs)) {
+        Job job = pool->jobs[pool->first_job];
+        pool->first_job += 1;
+        job.proc(job.data);
+    }
+    arrdeln(pool->jobs, 0, pool->first_job);
+    pool->first_job = 0;
+}
+
+void thread_pool_free(Thread_Pool *pool)
+{
+    arrfree(pool->jobs);
+}
+
+#endif // _WIN32
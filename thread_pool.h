@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef _WIN32
+#    include <pthread.h>
+#endif
+
+// A fixed set of worker threads pulling jobs off one queue. Jobs may add more jobs while they run,
+// thread_pool_wait() returns once the queue is empty and every worker is idle.
+//
+// On Windows there are no workers yet, thread_pool_wait() runs the jobs on the calling thread.
+
+typedef void (*Job_Proc)(void *data);
+
+typedef struct {
+    Job_Proc proc;
+    void *data;
+} Job;
+
+#ifndef _WIN32
+typedef pthread_mutex_t Mutex;
+#else
+typedef int Mutex; // TODO: CRITICAL_SECTION once we have worker threads on Windows.
+#endif
+
+void mutex_init(Mutex *mutex);
+void mutex_lock(Mutex *mutex);
+void mutex_unlock(Mutex *mutex);
+void mutex_destroy(Mutex *mutex);
+
+typedef struct {
+    Mutex mutex;
+#ifndef _WIN32
+    pthread_cond_t job_added;
+    pthread_cond_t job_done;
+    pthread_t *threads; // @malloced with stb_ds
+#endif
+
+    Job *jobs; // @malloced with stb_ds. Pending jobs are jobs[first_job..].
+    size_t first_job;
+    size_t busy_count; // Workers currently running a job.
+    bool quit;
+} Thread_Pool;
+
+int os_processor_count(void);
+
+void thread_pool_init(Thread_Pool *pool, int thread_count);
+void thread_pool_add_job(Thread_Pool *pool, Job_Proc proc, void *data);
+void thread_pool_wait(Thread_Pool *pool);
+void thread_pool_free(Thread_Pool *pool);
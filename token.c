@@ -1,6 +1,7 @@
-#include <ctype.h>
 #include <assert.h>
+#include <errno.h>
 #include <stdarg.h>
+#include <string.h> // memchr, memcmp, strerror
 
 #ifndef _WIN32
 #    include <sys/types.h>
@@ -12,52 +13,454 @@
 #endif // _WIN32
 
 #include "common.h"
+#include "hash.h"
 #include "parser.h"
 #include "workspace.h"
 #include "string_builder.h"
 #include "vendor/stb_ds.h"
 
-// All of these are @Internal.
-Token find_next_token(Parser *parser);
-void parser_next_line(Parser *parser);
-void parser_add_line_to_source_file(Parser *parser);
-
-#define parser_current_character_index(parser) ((parser)->current_line.data - (parser)->current_line_start)
+// @Internal
+#define parser_current_offset(parser) ((size_t)((parser)->cursor - (parser)->input_begin))
 
 inline int peek_character(Parser *parser)
 {
-    if (parser->current_line.count) return (int) *parser->current_line.data;
+    if (parser->cursor < parser->input_end) return (int) *parser->cursor;
     return -1;
 }
 
 static inline int eat_character(Parser *parser)
 {
-    assert(parser->current_line.count > 0);
-    int character = (int) *parser->current_line.data;
-    parser->current_line.data += 1;
-    parser->current_line.count -= 1;
+    assert(parser->cursor < parser->input_end);
+    int character = (int) *parser->cursor;
+    parser->cursor += 1;
     return character;
 }
 
-static inline bool starts_identifier(char x)
+// CHARACTER CLASSES
+//
+// We don't use <ctype.h> here, it depends on the locale and goes through a function call for every
+// byte. Everything at or above 0x80 is class 0, so UTF-8 never starts or continues an identifier.
+
+enum {
+    CHAR_SPACE      = 0x1, // ' ', '\t', '\v', '\f', '\r'
+    CHAR_NEWLINE    = 0x2,
+    CHAR_ALPHA      = 0x4,
+    CHAR_DIGIT      = 0x8,
+    CHAR_UNDERSCORE = 0x10,
+};
+
+#define CHAR_WHITESPACE (CHAR_SPACE | CHAR_NEWLINE)
+#define CHAR_IDENTIFIER (CHAR_ALPHA | CHAR_DIGIT | CHAR_UNDERSCORE)
+
+#define S_ CHAR_SPACE
+#define N_ CHAR_NEWLINE
+#define A_ CHAR_ALPHA
+#define D_ CHAR_DIGIT
+#define U_ CHAR_UNDERSCORE
+static const u8 character_class[256] = {
+//  0   1   2   3   4   5   6   7   8   9   a   b   c   d   e   f
+    0,  0,  0,  0,  0,  0,  0,  0,  0,  S_, N_, S_, S_, S_, 0,  0,  // 0x00
+    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  // 0x10
+    S_, 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  // 0x20
+    D_, D_, D_, D_, D_, D_, D_, D_, D_, D_, 0,  0,  0,  0,  0,  0,  // 0x30
+    0,  A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, // 0x40
+    A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, 0,  0,  0,  0,  U_, // 0x50
+    0,  A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, // 0x60
+    A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, 0,  0,  0,  0,  0,  // 0x70
+};
+#undef S_
+#undef N_
+#undef A_
+#undef D_
+#undef U_
+
+#define char_is(c, class) flag_has(character_class[(u8)(c)], (class))
+
+static inline bool starts_identifier(int x)
+{
+    return x >= 0 && char_is(x, CHAR_ALPHA | CHAR_UNDERSCORE);
+}
+
+static inline bool continues_identifier(int x)
 {
-    return isalpha(x) || x == '_';
+    return x >= 0 && char_is(x, CHAR_IDENTIFIER);
+}
+
+// SCANNING
+//
+// Long runs of whitespace, comment bodies and identifier characters are skipped a whole vector at
+// a time. Only unaligned loads are used and we never read past input_end, the last partial vector
+// always goes through the scalar loop. Define LEXER_NO_SIMD to force the scalar path everywhere.
+
+#if !defined(LEXER_NO_SIMD) && (defined(__GNUC__) || defined(__clang__))
+#    if defined(__AVX2__)
+#        include <immintrin.h>
+#        define LEXER_SIMD_WIDTH 32
+typedef __m256i Simd_Bytes;
+#        define simd_load(p)     _mm256_loadu_si256((const __m256i *)(p))
+#        define simd_set1(c)     _mm256_set1_epi8((char)(c))
+#        define simd_eq(a, b)    _mm256_cmpeq_epi8((a), (b))
+#        define simd_gt(a, b)    _mm256_cmpgt_epi8((a), (b))
+#        define simd_or(a, b)    _mm256_or_si256((a), (b))
+#        define simd_and(a, b)   _mm256_and_si256((a), (b))
+#        define simd_movemask(a) ((u32)_mm256_movemask_epi8(a))
+#        define SIMD_FULL_MASK   0xFFFFFFFFu
+#    elif defined(__SSE2__)
+#        include <emmintrin.h>
+#        define LEXER_SIMD_WIDTH 16
+typedef __m128i Simd_Bytes;
+#        define simd_load(p)     _mm_loadu_si128((const __m128i *)(p))
+#        define simd_set1(c)     _mm_set1_epi8((char)(c))
+#        define simd_eq(a, b)    _mm_cmpeq_epi8((a), (b))
+#        define simd_gt(a, b)    _mm_cmpgt_epi8((a), (b))
+#        define simd_or(a, b)    _mm_or_si128((a), (b))
+#        define simd_and(a, b)   _mm_and_si128((a), (b))
+#        define simd_movemask(a) ((u32)_mm_movemask_epi8(a))
+#        define SIMD_FULL_MASK   0xFFFFu
+#    endif
+#endif
+
+#ifdef LEXER_SIMD_WIDTH
+// The comparisons are signed, so bytes at or above 0x80 are negative and fall outside every range.
+#define simd_in_range(x, lo, hi) simd_and(simd_gt((x), simd_set1((lo) - 1)), simd_gt(simd_set1((hi) + 1), (x)))
+
+static inline u32 simd_identifier_mask(Simd_Bytes x)
+{
+    Simd_Bytes folded = simd_or(x, simd_set1(0x20)); // Maps 'A'-'Z' onto 'a'-'z' and nothing else onto it.
+    Simd_Bytes result = simd_in_range(folded, 'a', 'z');
+    result = simd_or(result, simd_in_range(x, '0', '9'));
+    result = simd_or(result, simd_eq(x, simd_set1('_')));
+    return simd_movemask(result);
+}
+
+static inline u32 simd_whitespace_mask(Simd_Bytes x)
+{
+    // '\t', '\n', '\v', '\f' and '\r' are contiguous.
+    Simd_Bytes result = simd_in_range(x, '\t', '\r');
+    result = simd_or(result, simd_eq(x, simd_set1(' ')));
+    return simd_movemask(result);
+}
+#endif // LEXER_SIMD_WIDTH
+
+static inline const char *scan_identifier(const char *at, const char *end)
+{
+#ifdef LEXER_SIMD_WIDTH
+    while (end - at >= LEXER_SIMD_WIDTH) {
+        u32 stop = ~simd_identifier_mask(simd_load(at)) & SIMD_FULL_MASK;
+        if (stop) return at + __builtin_ctz(stop);
+        at += LEXER_SIMD_WIDTH;
+    }
+#endif
+    while (at < end && char_is(*at, CHAR_IDENTIFIER)) at += 1;
+    return at;
+}
+
+static inline const char *scan_to_newline(const char *at, const char *end)
+{
+#ifdef LEXER_SIMD_WIDTH
+    Simd_Bytes newline = simd_set1('\n');
+    while (end - at >= LEXER_SIMD_WIDTH) {
+        u32 found = simd_movemask(simd_eq(simd_load(at), newline));
+        if (found) return at + __builtin_ctz(found);
+        at += LEXER_SIMD_WIDTH;
+    }
+#endif
+    while (at < end && *at != '\n') at += 1;
+    return at;
+}
+
+// Stops at the first '"', '\\' or '\n', which are the only characters a string literal cares about.
+static inline const char *scan_string_literal(const char *at, const char *end)
+{
+#ifdef LEXER_SIMD_WIDTH
+    Simd_Bytes quote = simd_set1('"');
+    Simd_Bytes backslash = simd_set1('\\');
+    Simd_Bytes newline = simd_set1('\n');
+    while (end - at >= LEXER_SIMD_WIDTH) {
+        Simd_Bytes x = simd_load(at);
+        u32 found = simd_movemask(simd_or(simd_or(simd_eq(x, quote), simd_eq(x, backslash)), simd_eq(x, newline)));
+        if (found) return at + __builtin_ctz(found);
+        at += LEXER_SIMD_WIDTH;
+    }
+#endif
+    while (at < end && *at != '"' && *at != '\\' && *at != '\n') at += 1;
+    return at;
+}
+
+static inline const char *scan_whitespace(const char *at, const char *end)
+{
+#ifdef LEXER_SIMD_WIDTH
+    while (end - at >= LEXER_SIMD_WIDTH) {
+        u32 stop = ~simd_whitespace_mask(simd_load(at)) & SIMD_FULL_MASK;
+        if (stop) return at + __builtin_ctz(stop);
+        at += LEXER_SIMD_WIDTH;
+    }
+#endif
+    while (at < end && char_is(*at, CHAR_WHITESPACE)) at += 1;
+    return at;
+}
+
+static inline String_View eat_identifier_characters(Parser *parser)
+{
+    const char *begin = parser->cursor;
+    parser->cursor = scan_identifier(parser->cursor, parser->input_end);
+    return sv_from_parts(begin, parser->cursor - begin);
+}
+
+static void skip_whitespace_and_comments(Parser *parser)
+{
+    while (parser->cursor < parser->input_end) {
+        char c = *parser->cursor;
+
+        if (char_is(c, CHAR_WHITESPACE)) {
+            parser->cursor = scan_whitespace(parser->cursor, parser->input_end);
+            continue;
+        }
+
+        if (c == '/' && parser->cursor + 1 < parser->input_end && parser->cursor[1] == '/') {
+            // Drop the rest of the line.
+            parser->cursor = scan_to_newline(parser->cursor + 2, parser->input_end);
+            continue;
+        }
+
+        break;
+    }
+}
+
+// Returns -1 for escapes we don't know about.
+static inline int decode_escape_character(int c)
+{
+    switch (c) {
+    case '0':  return '\0';
+    case 'n':  return '\n';
+    case 't':  return '\t';
+    case '"':  return '"';
+    case '\'': return '\'';
+    }
+    return -1;
+}
+
+// The escapes were already validated while lexing, illegal ones were reported and get dropped here.
+static String_View decode_string_literal(String_View literal, size_t decoded_count)
+{
+    char *data = context_alloc(decoded_count);
+    size_t count = 0;
+
+    for (size_t i = 0; i < literal.count; i++) {
+        if (literal.data[i] != '\\') {
+            data[count++] = literal.data[i];
+            continue;
+        }
+
+        i += 1;
+        int c = decode_escape_character(literal.data[i]);
+        if (c != -1) data[count++] = (char)c;
+    }
+
+    assert(count == decoded_count);
+    return sv_from_parts(data, count);
 }
 
-static inline bool continues_identifier(char x)
+// NUMBER PARSING
+
+static inline unsigned int digit_value(char c)
 {
-    return isalnum(x) || x == '_';
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return 99; // Not a digit in any base we support.
 }
 
-static bool parse_int_value(String_View s, unsigned int base, uint64_t *out)
+// Returns false if s has no digits or any character that isn't a digit in this base.
+static bool parse_int_value(String_View s, unsigned int base, uint64_t *out, bool *overflow)
 {
     uint64_t result = 0;
-    size_t i = 0;
-    for (; i < s.count && isdigit(s.data[i]); ++i) {
-        result = result * base + (uint64_t) s.data[i] - '0';
+    *overflow = false;
+
+    for (size_t i = 0; i < s.count; ++i) {
+        unsigned int digit = digit_value(s.data[i]);
+        if (digit >= base) return false;
+
+        if (result > (UINT64_MAX - digit) / base) *overflow = true;
+        result = result * base + digit;
     }
-    if (out) *out = result;
-    return i == s.count;
+
+    *out = result;
+    return s.count > 0;
+}
+
+#include "float_tables.h"
+
+typedef struct {
+    uint64_t high, low;
+} U128;
+
+static inline U128 full_multiplication(uint64_t a, uint64_t b)
+{
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+
+    uint64_t lo_lo = a_lo * b_lo;
+    uint64_t hi_lo = a_hi * b_lo;
+    uint64_t lo_hi = a_lo * b_hi;
+    uint64_t hi_hi = a_hi * b_hi;
+
+    uint64_t cross = (lo_lo >> 32) + (uint32_t)hi_lo + lo_hi;
+
+    U128 result;
+    result.high = hi_hi + (hi_lo >> 32) + (cross >> 32);
+    result.low = (cross << 32) | (uint32_t)lo_lo;
+    return result;
+}
+
+static inline int leading_zeroes(uint64_t x)
+{
+    int n = 0;
+    if (!(x >> 32)) { n += 32; x <<= 32; }
+    if (!(x >> 48)) { n += 16; x <<= 16; }
+    if (!(x >> 56)) { n += 8;  x <<= 8;  }
+    if (!(x >> 60)) { n += 4;  x <<= 4;  }
+    if (!(x >> 62)) { n += 2;  x <<= 2;  }
+    if (!(x >> 63)) { n += 1; }
+    return n;
+}
+
+#define DOUBLE_MANTISSA_BITS 52
+#define DOUBLE_MINIMUM_EXPONENT (-1023)
+#define DOUBLE_INFINITE_POWER 0x7FF
+
+// Computes w * 10^q rounded to the nearest double, see "Number Parsing at a Gigabyte per Second"
+// (Lemire, 2021). Returns false in the rare cases where the truncated product can't decide the
+// rounding, then the caller has to fall back to something slower.
+static bool eisel_lemire(uint64_t w, int64_t q, double *out)
+{
+    uint64_t mantissa;
+    int power2;
+
+    if (w == 0 || q < SMALLEST_POWER_OF_FIVE) {
+        mantissa = 0;
+        power2 = 0;
+    } else if (q > LARGEST_POWER_OF_FIVE) {
+        mantissa = 0;
+        power2 = DOUBLE_INFINITE_POWER;
+    } else {
+        int lz = leading_zeroes(w);
+        w <<= lz;
+
+        // 64 - 52 - 3 bits of the product are beyond what we keep, if they are all ones the low half could carry into them.
+        const uint64_t precision_mask = UINT64_MAX >> (DOUBLE_MANTISSA_BITS + 3);
+        size_t index = 2 * (size_t)(q - SMALLEST_POWER_OF_FIVE);
+        U128 product = full_multiplication(w, power_of_five_128[index]);
+        if ((product.high & precision_mask) == precision_mask) {
+            U128 second = full_multiplication(w, power_of_five_128[index + 1]);
+            product.low += second.high;
+            if (second.high > product.low) product.high += 1;
+            if (product.low == UINT64_MAX && (q < -27 || q > 55)) return false;
+        }
+
+        int upperbit = (int)(product.high >> 63);
+        int shift = upperbit + 64 - DOUBLE_MANTISSA_BITS - 3;
+        mantissa = product.high >> shift;
+        power2 = (int)((((152170 + 65536) * q) >> 16) + 63) + upperbit - lz - DOUBLE_MINIMUM_EXPONENT;
+
+        if (power2 <= 0) {
+            // Subnormal, or too small to represent at all.
+            if (-power2 + 1 >= 64) {
+                mantissa = 0;
+                power2 = 0;
+            } else {
+                mantissa >>= -power2 + 1;
+                mantissa += mantissa & 1;
+                mantissa >>= 1;
+                power2 = (mantissa < (1ull << DOUBLE_MANTISSA_BITS)) ? 0 : 1;
+            }
+        } else {
+            // Exactly halfway between two doubles, round to even instead of up.
+            if (product.low <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1) {
+                if ((mantissa << shift) == product.high) mantissa &= ~1ull;
+            }
+
+            mantissa += mantissa & 1;
+            mantissa >>= 1;
+            if (mantissa >= (2ull << DOUBLE_MANTISSA_BITS)) {
+                mantissa = 1ull << DOUBLE_MANTISSA_BITS;
+                power2 += 1;
+            }
+            mantissa &= ~(1ull << DOUBLE_MANTISSA_BITS);
+            if (power2 >= DOUBLE_INFINITE_POWER) {
+                mantissa = 0;
+                power2 = DOUBLE_INFINITE_POWER;
+            }
+        }
+    }
+
+    uint64_t bits = mantissa | ((uint64_t)power2 << DOUBLE_MANTISSA_BITS);
+    memcpy(out, &bits, sizeof(*out));
+    return true;
+}
+
+static const double exact_powers_of_ten[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// s is one or more digits, a '.' and zero or more digits. This never allocates unless we have to
+// fall back to strtod() on a literal that doesn't fit in a stack buffer.
+static double parse_float_value(String_View s)
+{
+    // Keep the first 19 significant digits in w, and track the decimal exponent for the rest.
+    uint64_t w = 0;
+    int64_t q = 0;
+    int digits = 0;
+    bool truncated = false;
+    bool after_dot = false;
+
+    for (size_t i = 0; i < s.count; i++) {
+        if (s.data[i] == '.') {
+            after_dot = true;
+            continue;
+        }
+
+        unsigned int digit = s.data[i] - '0';
+        if (digits == 0 && digit == 0) {
+            if (after_dot) q -= 1;
+            continue;
+        }
+
+        if (digits < 19) {
+            w = w * 10 + digit;
+            digits += 1;
+            if (after_dot) q -= 1;
+        } else {
+            if (digit != 0) truncated = true;
+            if (!after_dot) q += 1;
+        }
+    }
+
+    if (w == 0) return 0.0;
+
+    // Both operands are exact, so a single multiply or divide is correctly rounded.
+    if (!truncated && w <= (1ull << 53) && q >= -22 && q <= 22) {
+        if (q < 0) return (double)w / exact_powers_of_ten[-q];
+        return (double)w * exact_powers_of_ten[q];
+    }
+
+    double result;
+    if (eisel_lemire(w, q, &result)) {
+        if (!truncated) return result;
+
+        // The real value is somewhere between w and w+1 times 10^q, if both round the same we're done.
+        double upper;
+        if (eisel_lemire(w + 1, q, &upper) && upper == result) return result;
+    }
+
+    char buffer[128];
+    if (s.count < sizeof(buffer)) {
+        memcpy(buffer, s.data, s.count);
+        buffer[s.count] = '\0';
+        return strtod(buffer, NULL);
+    }
+    return strtod(arena_sv_to_cstr(&temporary_arena, s), NULL);
 }
 
 static inline void parse_maybe_equals_token(Parser *parser, Token *token, Token_Type type_with_equals)
@@ -68,145 +471,287 @@ static inline void parse_maybe_equals_token(Parser *parser, Token *token, Token_
     }
 }
 
-static Token_Type parse_directive_or_error(String_View s)
+typedef struct {
+    const char *name;
+    size_t length; // 0 for empty slots.
+    Token_Type type;
+} Keyword_Entry;
+
+#include "keywords.h"
+
+// The tables are perfect hashes, so a name can only ever be in the one slot its hash maps to.
+static inline Token_Type find_keyword(const Keyword_Entry *table, uint32_t seed, int bits, String_View s, uint32_t hash)
 {
-    if (sv_eq(s, SV("load"))) return TOKEN_DIRECTIVE_LOAD;
-    if (sv_eq(s, SV("import"))) return TOKEN_DIRECTIVE_IMPORT;
-    if (sv_eq(s, SV("system_library"))) return TOKEN_DIRECTIVE_SYSTEM_LIBRARY;
-    if (sv_eq(s, SV("foreign"))) return TOKEN_DIRECTIVE_FOREIGN;
+    const Keyword_Entry *entry = &table[hash_to_slot(hash, seed, bits)];
+    if (entry->length == s.count && memcmp(entry->name, s.data, s.count) == 0) return entry->type;
     return TOKEN_ERROR;
 }
 
-static Token_Type parse_keyword_or_ident_token_type(String_View s)
+static Token_Type parse_directive_or_error(String_View s)
 {
-    switch (s.count) {
-    case 2:
-        if (sv_eq2(s, SV("if"))) return TOKEN_KEYWORD_IF;
-        if (sv_eq2(s, SV("as"))) return TOKEN_KEYWORD_AS;
-        break;
-    case 3:
-        if (sv_eq2(s, SV("for"))) return TOKEN_KEYWORD_FOR;
-        break;
-    case 4:
-        if (sv_eq2(s, SV("then"))) return TOKEN_KEYWORD_THEN;
-        if (sv_eq2(s, SV("else"))) return TOKEN_KEYWORD_ELSE;
-        if (sv_eq2(s, SV("null"))) return TOKEN_KEYWORD_NULL;
-        if (sv_eq2(s, SV("enum"))) return TOKEN_KEYWORD_ENUM;
-        if (sv_eq2(s, SV("true"))) return TOKEN_KEYWORD_TRUE;
-        if (sv_eq2(s, SV("cast"))) return TOKEN_KEYWORD_CAST;
-        break;
-    case 5:
-        if (sv_eq2(s, SV("while"))) return TOKEN_KEYWORD_WHILE;
-        if (sv_eq2(s, SV("break"))) return TOKEN_KEYWORD_BREAK;
-        if (sv_eq2(s, SV("using"))) return TOKEN_KEYWORD_USING;
-        if (sv_eq2(s, SV("defer"))) return TOKEN_KEYWORD_DEFER;
-        if (sv_eq2(s, SV("false"))) return TOKEN_KEYWORD_FALSE;
-        if (sv_eq2(s, SV("union"))) return TOKEN_KEYWORD_UNION;
-        break;
-    case 6:
-        if (sv_eq2(s, SV("return"))) return TOKEN_KEYWORD_RETURN;
-        if (sv_eq2(s, SV("struct"))) return TOKEN_KEYWORD_STRUCT;
-        break;
-    case 7:
-        if (sv_eq2(s, SV("size_of"))) return TOKEN_KEYWORD_SIZE_OF;
-        if (sv_eq2(s, SV("type_of"))) return TOKEN_KEYWORD_TYPE_OF;
-        break;
-    case 8:
-        if (sv_eq2(s, SV("continue"))) return TOKEN_KEYWORD_CONTINUE;
-        break;
-    case 9:
-        if (sv_eq2(s, SV("type_info"))) return TOKEN_KEYWORD_TYPE_INFO;
-        break;
-    case 14:
-        if (sv_eq2(s, SV("initializer_of"))) return TOKEN_KEYWORD_INITIALIZER_OF;
-        break;
-    }
-    return TOKEN_IDENT;
+    uint32_t hash = hash_identifier(s.data, s.count);
+    return find_keyword(directive_table, DIRECTIVE_TABLE_SEED, DIRECTIVE_TABLE_BITS, s, hash);
 }
 
-inline void parser_add_line_to_source_file(Parser *parser)
+static Token_Type parse_keyword_or_ident_token_type(String_View s, uint32_t hash)
 {
-    String_View added_line = parser->current_line;
-    added_line.count += 1; // To include the newline.
-    arrput(parser->workspace->files[parser->file_index].lines, added_line);
+    Token_Type type = find_keyword(keyword_table, KEYWORD_TABLE_SEED, KEYWORD_TABLE_BITS, s, hash);
+    if (type == TOKEN_ERROR) return TOKEN_IDENT;
+    return type;
 }
 
-inline void parser_next_line(Parser *parser)
+// The line table is only used for printing diagnostics, so we build it the first time someone asks for a line.
+static void source_file_build_line_table(Source_File *file)
 {
-    parser->current_line = sv_chop_by_delim(&parser->current_input, '\n');
+    arrput(file->line_offsets, 0);
 
-    parser_add_line_to_source_file(parser);
+    const char *at = file->data;
+    const char *end = file->data + file->size;
+    while ((at = memchr(at, '\n', end - at)) != NULL) {
+        at += 1;
+        arrput(file->line_offsets, at - file->data);
+    }
+}
+
+// The returned line includes the newline, if it has one.
+String_View source_file_get_line(Source_File *file, int line_index)
+{
+    if (!file->line_offsets) source_file_build_line_table(file);
 
-    parser->current_line_start = parser->current_line.data;
-    parser->current_line = sv_trim_left(parser->current_line);
-    parser->current_line_number += 1;
+    if (line_index < 0 || line_index >= arrlen(file->line_offsets)) return SV_NULL;
+
+    size_t begin = file->line_offsets[line_index];
+    size_t end = (line_index + 1 < arrlen(file->line_offsets)) ? file->line_offsets[line_index + 1] : file->size;
+    return sv_from_parts(file->data + begin, end - begin);
 }
 
 inline Source_Location parser_current_location(Parser *parser)
 {
     Source_Location loc;
-    loc.l0 = parser->current_line_number;
-    loc.l1 = -1;
-    loc.c0 = parser_current_character_index(parser);
-    loc.c1 = -1;
-    loc.fid = parser->file_index;
+    loc.offset = (uint32_t) parser_current_offset(parser); // Files are never bigger than this, see SOURCE_FILE_MAX_SIZE.
+    loc.length = 0;
+    loc.fid = (uint16_t) parser->file_index;
     return loc;
 }
 
-Token find_next_token(Parser *parser)
+// Stretches the location from where it starts up to the cursor.
+static inline void location_end_at_cursor(Parser *parser, Source_Location *loc)
 {
-    parser->current_line = sv_trim_left(parser->current_line);
+    size_t length = parser_current_offset(parser) - loc->offset;
+    loc->length = (uint16_t) Min(size_t, length, SOURCE_LOCATION_MAX_LENGTH);
+}
 
-    // Find next non-empty line.
+Source_Location source_location_span(Source_Location begin, Source_Location end)
+{
+    assert(begin.fid == end.fid);
+    size_t length = (size_t)end.offset + end.length - begin.offset;
+    if (end.offset < begin.offset) length = begin.length;
 
-    while (parser->current_line.count == 0 && parser->current_input.count > 0) {
-        parser_next_line(parser); 
+    Source_Location loc = begin;
+    loc.length = (uint16_t) Min(size_t, length, SOURCE_LOCATION_MAX_LENGTH);
+    return loc;
+}
+
+Resolved_Location source_file_resolve_location(Source_File *file, Source_Location loc)
+{
+    if (!file->line_offsets) source_file_build_line_table(file);
+
+    // Find the last line that starts at or before the offset.
+    ptrdiff_t low = 0;
+    ptrdiff_t high = arrlen(file->line_offsets) - 1;
+    while (low < high) {
+        ptrdiff_t middle = low + (high - low + 1) / 2;
+        if (file->line_offsets[middle] <= loc.offset) low = middle;
+        else high = middle - 1;
+    }
+
+    String_View line = source_file_get_line(file, (int) low);
+    if (line.count > 0 && line.data[line.count - 1] == '\n') line.count -= 1;
+
+    Resolved_Location result;
+    result.line = (int) low;
+    result.c0 = (int)(loc.offset - file->line_offsets[low]);
+    // Spans that cross lines only get highlighted up to the end of the first one.
+    int line_end = Max(int, (int)line.count, result.c0);
+    result.c1 = Min(int, result.c0 + (int)loc.length, line_end);
+    return result;
+}
+
+// Bad number literals end compilation right away. A Token_Chunk lexer just stops instead, the
+// file gets lexed again in one piece to report the error.
+static Token stop_after_fatal_error(Parser *parser, Token token)
+{
+    if (!parser->errors_are_silent) exit(1);
+
+    parser->cursor = parser->input_end;
+    token.type = TOKEN_END_OF_INPUT;
+    return token;
+}
+
+// We can't lex the rest of a stream we could not read, and we don't want to quietly stop at the part
+// that we got, so this is the end of compiling.
+static void report_stream_error(Parser *parser, const char *format, ...)
+{
+    Workspace *w = parser->workspace;
+
+    va_list args;
+    va_start(args, format);
+
+    mutex_lock(&w->files_mutex);
+    fprintf(stderr, "Error: Could not read all of '"SV_Fmt"': ", SV_Arg(w->files[parser->file_index].path));
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    mutex_unlock(&w->files_mutex);
+
+    va_end(args);
+    exit(1);
+}
+
+// A streamed file only ever has whole lines in [input_begin, input_end), and no token crosses a
+// newline, so we only need more input once we have lexed everything up to input_end. Reads until
+// we have at least one more line, or the end of the input. Returns false if there is nothing more.
+static bool parser_read_more_input(Parser *parser)
+{
+    Source_Stream *stream = parser->stream;
+    if (!stream) return false;
+
+    char *data = (char *) parser->input_begin;
+    const char *old_end = parser->input_end;
+    bool finished = false;
+
+    while (parser->input_end == old_end) {
+        size_t room = SOURCE_FILE_MAX_SIZE - stream->received;
+        if (room == 0) {
+            report_stream_error(parser, "It is longer than the %zu bytes a source file can have.", SOURCE_FILE_MAX_SIZE);
+        }
+
+        size_t n;
+        if (!os_read_stream(stream, data + stream->received, Min(size_t, SOURCE_STREAM_READ_SIZE, room), &n)) {
+            report_stream_error(parser, "%s.", strerror(errno));
+        }
+        if (n == 0) {
+            // The last line doesn't have to end in a newline.
+            finished = true;
+            parser->input_end = data + stream->received;
+            break;
+        }
+
+        const char *newline = NULL;
+        for (const char *at = data + stream->received + n; at > data + stream->received; at--) {
+            if (at[-1] == '\n') {
+                newline = at;
+                break;
+            }
+        }
+        stream->received += n;
+        if (newline) parser->input_end = newline;
+    }
+
+    // Let diagnostics see the new lines.
+    Workspace *w = parser->workspace;
+    mutex_lock(&w->files_mutex);
+    Source_File *file = &w->files[parser->file_index];
+    file->size = parser->input_end - parser->input_begin;
+    arrfree(file->line_offsets);
+    file->line_offsets = NULL;
+    stream->finished = finished;
+    mutex_unlock(&w->files_mutex);
+
+    if (finished) parser->stream = NULL;
+    return parser->input_end != old_end;
+}
+
+Token find_next_token(Parser *parser)
+{
+    skip_whitespace_and_comments(parser);
+    while (parser->cursor >= parser->input_end && parser_read_more_input(parser)) {
+        skip_whitespace_and_comments(parser);
     }
 
     Token token;
     token.type = TOKEN_END_OF_INPUT;
     token.location = parser_current_location(parser);
+    token.number_flags = 0;
+    token.identifier_hash = 0;
 
-    if (parser->current_line.count == 0) return token;
+    if (parser->cursor >= parser->input_end) {
+        // Point at the end of the last line instead of the empty line after the final newline.
+        if (parser->input_end > parser->input_begin && parser->input_end[-1] == '\n') {
+            token.location.offset -= 1;
+        }
+        return token;
+    }
 
     int c = peek_character(parser);
 
     // TODO: Float literals starting with '.'
-    if (isdigit(c)) {
-        String_View literal = sv_chop_left_while(&parser->current_line, continues_identifier);
+    if (c >= 0 && char_is(c, CHAR_DIGIT)) {
+        String_View literal = eat_identifier_characters(parser);
         token.number_flags = 0;
         token.type = TOKEN_NUMBER;
-        token.location.c1 = parser_current_character_index(parser);
+        location_end_at_cursor(parser, &token.location);
+
+        unsigned int base = 10;
+        String_View digits = literal;
+        if (literal.count >= 2 && literal.data[0] == '0' && (literal.data[1] == 'x' || literal.data[1] == 'X')) {
+            base = 16;
+            token.number_flags |= NUMBER_FLAGS_HEX;
+            sv_chop_left(&digits, 2);
+        } else if (literal.count >= 2 && literal.data[0] == '0' && (literal.data[1] == 'b' || literal.data[1] == 'B')) {
+            base = 2;
+            token.number_flags |= NUMBER_FLAGS_BINARY;
+            sv_chop_left(&digits, 2);
+        }
+
+        // A '.' followed by another '.' is a range, like in 0..10.
+        bool is_float = peek_character(parser) == '.' &&
+            !(parser->cursor + 1 < parser->input_end && parser->cursor[1] == '.');
+
+        if (is_float) {
+            if (base != 10) {
+                parser_report_error(parser, token.location, "Only decimal number literals can have a fractional part.");
+                return stop_after_fatal_error(parser, token);
+            }
+            for (size_t i = 0; i < literal.count; i++) {
+                if (!char_is(literal.data[i], CHAR_DIGIT)) {
+                    parser_report_error(parser, token.location, "Illegal characters in number literal.");
+                    return stop_after_fatal_error(parser, token);
+                }
+            }
 
-        if (peek_character(parser) == '.') {
             size_t n = 1;
-            for (; n < parser->current_line.count && continues_identifier(parser->current_line.data[n]); ++n) {
-                if (!isdigit(parser->current_line.data[n])) {
-                    token.location.c1 += n;
+            for (; parser->cursor + n < parser->input_end && continues_identifier(parser->cursor[n]); ++n) {
+                if (!char_is(parser->cursor[n], CHAR_DIGIT)) {
+                    token.location.length += n;
                     parser_report_error(parser, token.location, "Illegal character in number literal.");
-                    exit(1);
+                    return stop_after_fatal_error(parser, token);
                 }
             }
-            sv_chop_left(&parser->current_line, n);
+            parser->cursor += n;
             literal.count += n;
-            const char *cstr = arena_sv_to_cstr(&temporary_arena, literal);
-            token.double_value = strtod(cstr, NULL);
+            token.double_value = parse_float_value(literal);
             token.number_flags |= NUMBER_FLAGS_FLOAT;
-            token.location.c1 = parser_current_character_index(parser);
+            location_end_at_cursor(parser, &token.location);
             return token;
         }
-        
-        if (!parse_int_value(literal, 10, &token.integer_value)) {
+
+        bool overflow;
+        if (!parse_int_value(digits, base, &token.integer_value, &overflow)) {
             parser_report_error(parser, token.location, "Illegal characters in number literal.");
-            exit(1);
+            return stop_after_fatal_error(parser, token);
+        }
+        if (overflow) {
+            parser_report_error(parser, token.location, "Number literal does not fit in 64 bits.");
+            return stop_after_fatal_error(parser, token);
         }
         return token;
     }
 
     if (starts_identifier(c)) {
-        String_View literal = sv_chop_left_while(&parser->current_line, continues_identifier);
-        token.location.c1 = parser_current_character_index(parser);
-        token.type = parse_keyword_or_ident_token_type(literal);
+        String_View literal = eat_identifier_characters(parser);
+        location_end_at_cursor(parser, &token.location);
+        token.identifier_hash = hash_identifier(literal.data, literal.count);
+        token.type = parse_keyword_or_ident_token_type(literal, token.identifier_hash);
         if (token.type == TOKEN_IDENT) {
             token.string_value = literal;
         }
@@ -217,42 +762,44 @@ Token find_next_token(Parser *parser)
 
     switch (token.type) {
     case '"': {
-        String_Builder sb = {0};
+        // String literals end at the end of the line. Most of them have no escapes and point straight
+        // into the source, the rest get decoded into a buffer of exactly the right size afterwards.
+        const char *body = parser->cursor;
+        size_t escapes_dropped = 0; // How many bytes decoding removes.
 
-        while (peek_character(parser) != -1) {
-            c = eat_character(parser);
+        while (true) {
+            parser->cursor = scan_string_literal(parser->cursor, parser->input_end);
+            c = peek_character(parser);
+            if (c != '\\') break;
 
-            if (c == '"') {
-                token.type = TOKEN_STRING;
-                token.string_value.data = sb.data;
-                token.string_value.count = sb.count;
-                token.location.c1 = parser_current_character_index(parser);
-                return token;
+            eat_character(parser);
+            c = peek_character(parser);
+            if (c == -1 || c == '\n') {
+                parser_report_error(parser, parser_current_location(parser),
+                    "While parsing a string literal, we encountered a backslash with no following character.");
+                break;
             }
+            eat_character(parser);
 
-            if (c == '\\') {
-                c = eat_character(parser);
-                switch (c) {
-                case -1:
-                    parser_report_error(parser, parser_current_location(parser),
-                        "While parsing a string literal, we encountered a backslash with no following character.");
-                case '0':  sb_append(&sb, "\0", 1); break;
-                case 'n':  sb_append(&sb, "\n", 1); break;
-                case 't':  sb_append(&sb, "\t", 1); break;
-                case '"':  sb_append(&sb, "\"", 1); break;
-                case '\'': sb_append(&sb, "'", 1);  break;
-                default:
-                    parser_report_error(parser, parser_current_location(parser),
-                        "Illegal escape sequence '%c'.", (char)c);
-                }
-                continue;
+            if (decode_escape_character(c) == -1) {
+                parser_report_error(parser, parser_current_location(parser),
+                    "Illegal escape sequence '%c'.", (char)c);
+                escapes_dropped += 2;
+            } else {
+                escapes_dropped += 1;
             }
+        }
 
-            char str = (char)c;
-            sb_append(&sb, &str, 1);
+        if (c == '"') {
+            String_View literal = sv_from_parts(body, parser->cursor - body);
+            eat_character(parser);
+            token.type = TOKEN_STRING;
+            token.string_value = escapes_dropped ? decode_string_literal(literal, literal.count - escapes_dropped) : literal;
+            location_end_at_cursor(parser, &token.location);
+            return token;
         }
-            
-        token.location.c1 = parser_current_character_index(parser);
+
+        location_end_at_cursor(parser, &token.location);
         parser_report_error(parser, token.location, "While parsing a string literal, we encountered the end of the input.");
     }
     case '-': {
@@ -267,18 +814,7 @@ Token find_next_token(Parser *parser)
     } break;
     case '+': parse_maybe_equals_token(parser, &token, TOKEN_PLUSEQUALS); break;
     case '*': parse_maybe_equals_token(parser, &token, TOKEN_TIMESEQUALS); break;
-    // case '/': parse_maybe_equals_token(parser, &token, TOKEN_DIVEQUALS); break;
-    case '/': {
-        int d = peek_character(parser);
-        if (d == '=') {
-            eat_character(parser);
-            token.type = TOKEN_DIVEQUALS;
-        } else if (d == '/') {
-            eat_character(parser);
-            parser->current_line.count = 0; // Drop the line.
-            return find_next_token(parser); // Discard the current token.
-        }
-    } break;
+    case '/': parse_maybe_equals_token(parser, &token, TOKEN_DIVEQUALS); break; // Comments were skipped already.
     case '%': parse_maybe_equals_token(parser, &token, TOKEN_MODEQUALS); break;
     case '=': parse_maybe_equals_token(parser, &token, TOKEN_ISEQUAL); break;
     case '!': parse_maybe_equals_token(parser, &token, TOKEN_ISNOTEQUAL); break;
@@ -342,9 +878,9 @@ Token find_next_token(Parser *parser)
     case '~':
         break;
     case '#':
-        if (isalpha(peek_character(parser))) {
-            String_View literal = sv_chop_left_while(&parser->current_line, continues_identifier);
-            token.location.c1 = parser_current_character_index(parser);
+        if (peek_character(parser) >= 0 && char_is(peek_character(parser), CHAR_ALPHA)) {
+            String_View literal = eat_identifier_characters(parser);
+            location_end_at_cursor(parser, &token.location);
             token.type = parse_directive_or_error(literal);
             if (token.type == TOKEN_ERROR) {
                 parser_report_error(parser, token.location, "Unknown directive '"SV_Fmt"'.", SV_Arg(literal));
@@ -356,7 +892,7 @@ Token find_next_token(Parser *parser)
         token.type = TOKEN_ERROR;
     }
 
-    token.location.c1 = parser_current_character_index(parser);
+    location_end_at_cursor(parser, &token.location);
     return token;
 }
 
@@ -431,6 +967,176 @@ bool path_file_exist(const char *file_path)
 #endif
 }
 
+static void tokenize_into_stream(Parser *parser, Token_Stream *stream)
+{
+    // A rough guess so we don't regrow the arrays too many times on big files.
+    size_t expected_count = (parser->input_end - parser->cursor) / 4 + 1;
+    arrsetcap(stream->types, expected_count);
+    arrsetcap(stream->locations, expected_count);
+    arrsetcap(stream->payload_indices, expected_count);
+    arrput(stream->payloads, (Token_Payload){0});
+
+    while (true) {
+        Token token = find_next_token(parser);
+        arrput(stream->types, (uint16_t) token.type);
+        arrput(stream->locations, token.location);
+
+        if (token.type == TOKEN_IDENT || token.type == TOKEN_NUMBER || token.type == TOKEN_STRING) {
+            Token_Payload payload;
+            payload.string_value = token.string_value; // Copies the whole union.
+            payload.number_flags = token.number_flags;
+            payload.identifier_hash = token.identifier_hash;
+            arrput(stream->payload_indices, (uint32_t) arrlen(stream->payloads));
+            arrput(stream->payloads, payload);
+        } else {
+            arrput(stream->payload_indices, 0);
+        }
+
+        if (token.type == TOKEN_END_OF_INPUT) break;
+    }
+}
+
+void parser_tokenize_entire_file(Parser *parser)
+{
+    assert(parser->token_stream == NULL && parser->peek_count == 0);
+
+    Token_Stream *stream = calloc(1, sizeof(*stream));
+    assert(stream != NULL && "Ran out of memory");
+
+    tokenize_into_stream(parser, stream);
+
+    parser->token_stream = stream;
+    parser->token_cursor = 0;
+}
+
+// No token crosses a newline: string literals end at the end of the line and there are only
+// line comments. So a file cut right after any '\n' lexes into the same tokens piece by piece,
+// and the pieces can be lexed on different threads. Locations are offsets into the whole file,
+// so nothing needs fixing up when the pieces are joined back together.
+//
+// The chunks get allocated in the context arena. Returns how many there are, which can be fewer
+// than asked for if the file doesn't have enough lines.
+size_t parser_split_into_token_chunks(Parser *parser, size_t chunk_count, Token_Chunk **chunks)
+{
+    assert(parser->token_stream == NULL && parser->peek_count == 0);
+    assert(chunk_count > 0);
+
+    Token_Chunk *result = context_alloc(chunk_count * sizeof(*result));
+    memset(result, 0, chunk_count * sizeof(*result));
+
+    const char *begin = parser->cursor;
+    const char *end = parser->input_end;
+    size_t chunk_size = (end - begin) / chunk_count;
+
+    size_t count = 0;
+    while (begin < end) {
+        const char *split = end;
+        if (count + 1 < chunk_count && (size_t)(end - begin) > chunk_size) {
+            const char *newline = memchr(begin + chunk_size, '\n', end - (begin + chunk_size));
+            if (newline) split = newline + 1;
+        }
+
+        Token_Chunk *chunk = &result[count];
+        chunk->lexer = parser_init(parser->workspace, parser->file_index);
+        chunk->lexer->cursor = begin;
+        chunk->lexer->input_end = split;
+        chunk->lexer->errors_are_silent = true;
+        count += 1;
+
+        begin = split;
+    }
+
+    *chunks = result;
+    return count;
+}
+
+// Called on any thread.
+void token_chunk_lex(Token_Chunk *chunk)
+{
+    Push_Arena(&chunk->arena);
+    tokenize_into_stream(chunk->lexer, &chunk->stream);
+    Pop_Arena();
+}
+
+// Concatenates the tokens of the chunks into the parser's Token_Stream, dropping the end of input
+// tokens of all but the last chunk. If lexing any of the chunks failed we return false and the
+// caller has to lex the file again in one piece, so the errors get reported in order.
+bool parser_join_token_chunks(Parser *parser, Token_Chunk *chunks, size_t chunk_count)
+{
+    assert(parser->token_stream == NULL && parser->peek_count == 0);
+
+    bool ok = true;
+    size_t token_count = 0;
+    size_t payload_count = 1;
+    for (size_t i = 0; i < chunk_count; i++) {
+        if (chunks[i].lexer->reported_error) ok = false;
+        token_count += arrlenu(chunks[i].stream.types) - 1;
+        payload_count += arrlenu(chunks[i].stream.payloads) - 1;
+    }
+    token_count += 1;
+
+    Token_Stream *stream = NULL;
+    if (ok) {
+        stream = calloc(1, sizeof(*stream));
+        assert(stream != NULL && "Ran out of memory");
+
+        arrsetcap(stream->types, token_count);
+        arrsetcap(stream->locations, token_count);
+        arrsetcap(stream->payload_indices, token_count);
+        arrsetcap(stream->payloads, payload_count);
+        arrput(stream->payloads, (Token_Payload){0});
+    }
+
+    for (size_t i = 0; i < chunk_count; i++) {
+        Token_Stream *piece = &chunks[i].stream;
+
+        if (ok) {
+            size_t count = arrlenu(piece->types);
+            if (i + 1 < chunk_count) count -= 1; // Only the last chunk ends the input.
+
+            uint32_t payload_base = (uint32_t) arrlenu(stream->payloads) - 1; // Every piece has its own dummy payload 0.
+            for (size_t t = 0; t < count; t++) {
+                arrput(stream->types, piece->types[t]);
+                arrput(stream->locations, piece->locations[t]);
+                uint32_t index = piece->payload_indices[t];
+                arrput(stream->payload_indices, index ? index + payload_base : 0);
+            }
+            for (size_t k = 1; k < arrlenu(piece->payloads); k++) arrput(stream->payloads, piece->payloads[k]);
+        }
+
+        arrfree(piece->types);
+        arrfree(piece->locations);
+        arrfree(piece->payload_indices);
+        arrfree(piece->payloads);
+        parser_free(chunks[i].lexer);
+        chunks[i].lexer = NULL;
+    }
+
+    if (!ok) return false;
+
+    parser->cursor = parser->input_end;
+    parser->token_stream = stream;
+    parser->token_cursor = 0;
+    return true;
+}
+
+static inline Token token_stream_get(const Token_Stream *stream, size_t index)
+{
+    // Once we run off the end, keep returning TOKEN_END_OF_INPUT.
+    size_t last = arrlen(stream->types) - 1;
+    if (index > last) index = last;
+
+    const Token_Payload *payload = &stream->payloads[stream->payload_indices[index]];
+
+    Token token;
+    token.type = stream->types[index];
+    token.location = stream->locations[index];
+    token.string_value = payload->string_value; // Copies the whole union.
+    token.number_flags = payload->number_flags;
+    token.identifier_hash = payload->identifier_hash;
+    return token;
+}
+
 inline Token parser_fill_peek_buffer(Parser *parser)
 {
     assert(parser->peek_count < PARSER_PEEK_CAPACITY); // Peeked too many times.
@@ -443,6 +1149,8 @@ inline Token parser_fill_peek_buffer(Parser *parser)
 
 inline Token peek_token(Parser *parser, size_t user_index)
 {
+    if (parser->token_stream) return token_stream_get(parser->token_stream, parser->token_cursor + user_index);
+
     assert(user_index < PARSER_PEEK_CAPACITY);
     
     if (user_index < parser->peek_count) {
@@ -462,6 +1170,12 @@ inline Token peek_next_token(Parser *parser)
 
 inline Token eat_next_token(Parser *parser)
 {
+    if (parser->token_stream) {
+        Token result = token_stream_get(parser->token_stream, parser->token_cursor);
+        if (result.type != TOKEN_END_OF_INPUT) parser->token_cursor += 1;
+        return result;
+    }
+
     if (parser->peek_count == 0) return find_next_token(parser);
     const size_t internal_index = parser->peek_begin % PARSER_PEEK_CAPACITY;
     const Token result = parser->peek_buffer[internal_index];
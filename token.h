@@ -81,23 +81,36 @@ typedef enum {
 
 const char *token_type_to_string(int type);
 
-// l0 is the index of the starting line. l1 is the index of the ending line.
-// c0 is the index of the starting character (in bytes). c1 is the index of
-// the ending character.
-// @Volatile: These are all 0-based, because we're true programmers.
+// This is stored in every token and AST node, so it is kept to 8 bytes. Lines and columns are
+// only worked out when printing a diagnostic, see source_file_resolve_location().
+// @Volatile: offset is a 0-based byte offset into the file's data.
 typedef struct {
-    int l0, l1; // line range
-    int c0, c1; // character range
-    int fid; // file index
+    uint32_t offset;
+    uint16_t length; // In bytes, saturates at SOURCE_LOCATION_MAX_LENGTH.
+    uint16_t fid; // file index
 } Source_Location;
 
+#define SOURCE_LOCATION_MAX_LENGTH UINT16_MAX
+
+// So that offset and fid always fit: a bigger file, or one file more, is an error when it gets read
+// or loaded. A location at the end of the input has offset == size, so the size can be UINT32_MAX.
+#define SOURCE_FILE_MAX_SIZE ((size_t)UINT32_MAX)
+#define SOURCE_FILE_MAX_COUNT ((size_t)UINT16_MAX + 1)
+
+// What a Source_Location turns into for printing.
+// @Volatile: These are all 0-based, because we're true programmers.
+typedef struct {
+    int line;
+    int c0, c1; // Byte range within the line.
+} Resolved_Location;
+
 #ifndef _WIN32
 #define Loc_Fmt SV_Fmt":%d:%d"
 #else
 #define Loc_Fmt SV_Fmt"%s:%d,%d"
 #endif
 
-#define Loc_Arg(loc) (loc).l0+1, (loc).c0+1
+#define Loc_Arg(resolved) (resolved).line+1, (resolved).c0+1
 
 typedef struct {
     int type;
@@ -106,12 +119,34 @@ typedef struct {
     union {
         unsigned long integer_value;
         double double_value;
-        String_View string_value; // Must be copied to save in AST.
+        String_View string_value; // Points into the source file unless the literal had escapes.
     };
 
     unsigned int number_flags; // If a number.
+    uint32_t identifier_hash; // If an identifier, see hash_identifier().
 } Token;
 
+// Everything in a Token except its type and location.
+typedef struct {
+    union {
+        unsigned long integer_value;
+        double double_value;
+        String_View string_value;
+    };
+    unsigned int number_flags;
+    uint32_t identifier_hash;
+} Token_Payload;
+
+// A whole file lexed up front into parallel arrays, indexed by token number. Only identifiers,
+// numbers and strings get a payload, every other token uses the empty payload at index 0.
+// The last token is always TOKEN_END_OF_INPUT.
+typedef struct {
+    uint16_t *types; // @malloced with stb_ds, as are the rest.
+    Source_Location *locations;
+    uint32_t *payload_indices;
+    Token_Payload *payloads;
+} Token_Stream;
+
 enum {
     NUMBER_FLAGS_BINARY = 0x1,
     NUMBER_FLAGS_HEX = 0x2,
@@ -120,11 +155,38 @@ enum {
     NUMBER_FLAGS_SIGNED = 0x10, // Explicit + or -
 };
 
+typedef enum {
+    SOURCE_FILE_MALLOCED = 0, // data is ours and gets free()d.
+    SOURCE_FILE_MAPPED = 1, // data is a read-only mmap() of the file and gets munmap()ed.
+    SOURCE_FILE_STREAMED = 2, // data is a reservation of SOURCE_STREAM_RESERVE bytes that we read a pipe into, see Source_Stream.
+} Source_File_Ownership;
+
+// Pipes and stdin get read while we lex them instead of all at once up front, so we can parse
+// while the program writing into the pipe is still generating the rest. The data goes into one
+// big reservation of address space that only gets memory as we read into it, so it never moves:
+// tokens and the AST point into it. Like any file, a stream can't be longer than SOURCE_FILE_MAX_SIZE,
+// see parser_read_more_input().
+#define SOURCE_STREAM_RESERVE ((size_t)1 << 32) // 4 GB, just enough for SOURCE_FILE_MAX_SIZE.
+#define SOURCE_STREAM_READ_SIZE (64 * 1024)
+
+typedef struct {
+    int fd;
+    size_t received; // data[0..received) has been read, Source_File.size only counts the whole lines of it.
+    bool finished; // Hit the end of the input. Guarded by Workspace.files_mutex, like the Source_File.
+} Source_Stream;
+
 typedef struct {
     String_View name, path;
-    char *data; // @Copy @Owned
+    char *data; // @Owned, see ownership. Never written to, it may be mapped read-only.
     size_t size;
-    String_View *lines; // Points into this->data
+    Source_File_Ownership ownership;
+    Source_Stream *stream; // @Owned. Only for SOURCE_FILE_STREAMED.
+    size_t *line_offsets; // @Lazy: Only built when a diagnostic needs it, see source_file_get_line().
 } Source_File;
 
 Source_File os_read_entire_file(const char *path_as_cstr);
+bool os_read_stream(Source_Stream *stream, char *buffer, size_t size, size_t *count);
+void source_file_free(Source_File *file);
+String_View source_file_get_line(Source_File *file, int line_index);
+Resolved_Location source_file_resolve_location(Source_File *file, Source_Location loc);
+Source_Location source_location_span(Source_Location begin, Source_Location end);
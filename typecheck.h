@@ -65,20 +65,21 @@ typedef struct {
 } Type_Info_Array;
 
 bool run_typecheck_queue(Workspace *w, Ast_Declaration *decl);
-void typecheck_declaration(Workspace *w, Ast_Declaration *decl);
+Ast_Declaration *typecheck_declaration(Workspace *w, Ast_Declaration *decl);
+bool declaration_is_ready_for(const Ast_Declaration *decl, bool signature_only);
 
 void typecheck_number(Workspace *w, Ast_Number *number, Ast_Type_Definition *supplied_type);
 void typecheck_literal(Workspace *w, Ast_Literal *literal);
-void typecheck_identifier(Workspace *w, Ast_Ident **ident);
-void typecheck_unary_operator(Workspace *w, Ast_Unary_Operator **unary);
-void typecheck_binary_operator(Workspace *w, Ast_Binary_Operator **binary);
+void typecheck_identifier(Workspace *w, Ast_Handle *slot);
+void typecheck_unary_operator(Workspace *w, Ast_Handle *slot);
+void typecheck_binary_operator(Workspace *w, Ast_Handle *slot);
 void typecheck_procedure(Workspace *w, Ast_Procedure *procedure);
 void typecheck_procedure_call(Workspace *w, Ast_Procedure_Call *call);
-void typecheck_definition(Workspace *w, Ast_Type_Definition **type);
-void typecheck_instantiation(Workspace *w, Ast_Type_Instantiation **inst);
+void typecheck_definition(Workspace *w, Ast_Handle *slot);
+void typecheck_instantiation(Workspace *w, Ast_Handle *slot);
 void typecheck_cast(Workspace *w, Ast_Cast *cast);
-void typecheck_selector(Workspace *w, Ast_Selector **selector);
-void typecheck_expression(Workspace *w, Ast_Expression **expression);
+void typecheck_selector(Workspace *w, Ast_Handle *slot);
+void typecheck_expression(Workspace *w, Ast_Handle *slot);
 
 void typecheck_while(Workspace *w, Ast_While *while_stmt);
 void typecheck_if(Workspace *w, Ast_If *if_stmt);
@@ -95,13 +96,13 @@ Ast_Expression *constant_arithmetic_or_comparison(Workspace *w, Ast_Binary_Opera
 Ast_Type_Definition *typecheck_binary_int_operator(Workspace *w, Ast_Binary_Operator *binary);
 Ast_Type_Definition *typecheck_binary_arithmetic(Workspace *w, Ast_Binary_Operator *binary);
 void typecheck_selector_on_string(Workspace *w, Ast_Selector *selector);
-void typecheck_selector_on_array(Workspace *w, Ast_Selector **selector, Ast_Type_Definition *defn);
+void typecheck_selector_on_array(Workspace *w, Ast_Handle *slot, Ast_Type_Definition *defn);
 
-void flatten_expr_for_typechecking(Ast_Declaration *root, Ast_Expression **expr);
+void flatten_expr_for_typechecking(Ast_Declaration *root, Ast_Handle *slot);
 void flatten_stmt_for_typechecking(Ast_Declaration *root, Ast_Statement *stmt);
 void flatten_decl_for_typechecking(Ast_Declaration *decl);
 
-bool check_that_types_match(Workspace *w, Ast_Expression **expr, Ast_Type_Definition *type);
+bool check_that_types_match(Workspace *w, Ast_Handle *expr, Ast_Type_Definition *type);
 bool types_are_equal(Ast_Type_Definition *x, Ast_Type_Definition *y);
 
 Ast_Literal *make_literal(Literal_Kind kind);
@@ -1,17 +1,31 @@
+#define _DEFAULT_SOURCE // madvise, MAP_ANONYMOUS
 #include <errno.h>
 #include <string.h> // strerror...
 #include <limits.h>
 #include <float.h>
+#include <time.h>
+
+#ifndef _WIN32
+#    include <fcntl.h>
+#    include <unistd.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#endif // _WIN32
 
 #include "workspace.h"
+#include "hash.h"
 
-void workspace_parse_entire_file(Workspace *w, Source_File file);
+static double get_time_in_seconds(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
 
 static Ast_Type_Definition *make_type_definition(Workspace *w, const char *name, Type_Def_Kind kind, int size_bytes)
 {
-    Ast_Type_Definition *defn = context_alloc(sizeof(*defn));
-    defn->_expression.kind = AST_TYPE_DEFINITION;
-    defn->_expression.inferred_type = w->type_def_type;
+    Ast_Type_Definition *defn = ast_alloc((Source_Location){0}, AST_TYPE_DEFINITION);
+    defn->_expression.inferred_type = ast_handle(w->type_def_type);
     defn->name = name;
     defn->kind = kind;
     defn->size = size_bytes;
@@ -28,13 +42,15 @@ static Ast_Type_Definition *make_type_definition_literal(Workspace *w, Literal_K
 static Ast_Type_Definition *make_type_definition_integer(Workspace *w, const char *literal_name, int size_bytes, bool is_signed, unsigned long low, unsigned long high)
 {
     Ast_Type_Definition *defn = make_type_definition(w, literal_name, TYPE_DEF_NUMBER, size_bytes);
-    defn->number.literal_low = make_number(low);
-    defn->number.literal_high = make_number(high);
+    Ast_Number *literal_low = make_number(low);
+    Ast_Number *literal_high = make_number(high);
     if (is_signed) {
         defn->number.flags = NUMBER_FLAGS_SIGNED;
-        defn->number.literal_low->flags |= NUMBER_FLAGS_SIGNED;
-        defn->number.literal_high->flags |= NUMBER_FLAGS_SIGNED;
+        literal_low->flags |= NUMBER_FLAGS_SIGNED;
+        literal_high->flags |= NUMBER_FLAGS_SIGNED;
     }
+    defn->number.literal_low = ast_handle(literal_low);
+    defn->number.literal_high = ast_handle(literal_high);
     return defn;
 }
 
@@ -42,76 +58,180 @@ static Ast_Type_Definition *make_type_definition_float(Workspace *w, const char
 {
     Ast_Type_Definition *defn = make_type_definition(w, literal_name, TYPE_DEF_NUMBER, size_bytes);
     defn->number.flags = NUMBER_FLAGS_FLOAT;
-    defn->number.literal_low = make_number_float(low);
-    defn->number.literal_high = make_number_float(high);
+    Ast_Number *literal_low = make_number_float(low);
+    Ast_Number *literal_high = make_number_float(high);
     if (requires_float64) {
         defn->number.flags |= NUMBER_FLAGS_FLOAT64;
-        defn->number.literal_low->flags |= NUMBER_FLAGS_FLOAT64;
-        defn->number.literal_high->flags |= NUMBER_FLAGS_FLOAT64;
+        literal_low->flags |= NUMBER_FLAGS_FLOAT64;
+        literal_high->flags |= NUMBER_FLAGS_FLOAT64;
     }
+    defn->number.literal_low = ast_handle(literal_low);
+    defn->number.literal_high = ast_handle(literal_high);
     return defn;
 }
 
 inline Ast_Number *make_number(unsigned long value)
 {
-    Ast_Number *number = context_alloc(sizeof(*number));
-    number->_expression.kind = AST_NUMBER;
+    Ast_Number *number = ast_alloc((Source_Location){0}, AST_NUMBER);
     number->as.integer = value;
     return number;
 }
 
 inline Ast_Number *make_number_float(double value)
 {
-    Ast_Number *number = context_alloc(sizeof(*number));
-    number->_expression.kind = AST_NUMBER;
+    Ast_Number *number = ast_alloc((Source_Location){0}, AST_NUMBER);
     number->flags = NUMBER_FLAGS_FLOAT;
     number->as.real = value;
     return number;
 }
 
-// Currently, this always uses malloc because we call free() on the data,
-// and we don't have a system in C for storing the allocator that allocated the data.
+#ifndef _WIN32
+// Only regular, non-empty files can be mapped. Everything else (pipes, devices, or a failed
+// mapping) returns false and gets read the slow way.
+static bool os_map_entire_file(const char *path_as_cstr, Source_File *file)
+{
+    int fd = open(path_as_cstr, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) < 0 || !S_ISREG(statbuf.st_mode) || statbuf.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = (size_t) statbuf.st_size;
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps the file alive.
+    if (mapping == MAP_FAILED) return false;
+
+    // The lexer goes through the file once from start to end.
+    madvise(mapping, size, MADV_SEQUENTIAL);
+
+    file->data = mapping;
+    file->size = size;
+    file->ownership = SOURCE_FILE_MAPPED;
+    return true;
+}
+
+// Pipes, FIFOs and terminals don't get read here, the lexer reads them as it goes. "-" is stdin.
+static bool os_open_stream(const char *path_as_cstr, Source_File *file)
+{
+    bool is_stdin = strcmp(path_as_cstr, "-") == 0;
+    int fd = is_stdin ? STDIN_FILENO : open(path_as_cstr, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) < 0 || S_ISREG(statbuf.st_mode) || S_ISDIR(statbuf.st_mode)) {
+        if (!is_stdin) close(fd);
+        return false;
+    }
+
+    // MAP_NORESERVE: Pages only get memory once we read into them.
+    void *mapping = mmap(NULL, SOURCE_STREAM_RESERVE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping == MAP_FAILED) {
+        if (!is_stdin) close(fd);
+        return false;
+    }
+
+    Source_Stream *stream = malloc(sizeof(*stream));
+    stream->fd = fd;
+    stream->received = 0;
+    stream->finished = false;
+
+    if (is_stdin) {
+        file->name = (String_View)SV_STATIC("stdin");
+        file->path = (String_View)SV_STATIC("stdin");
+    }
+    file->data = mapping;
+    file->size = 0;
+    file->ownership = SOURCE_FILE_STREAMED;
+    file->stream = stream;
+    return true;
+}
+#endif // _WIN32
+
+// Sets *count to 0 at the end of the input. Returns false if reading failed, errno says why.
+bool os_read_stream(Source_Stream *stream, char *buffer, size_t size, size_t *count)
+{
+#ifndef _WIN32
+    while (true) {
+        ssize_t n = read(stream->fd, buffer, size);
+        if (n >= 0) {
+            *count = (size_t) n;
+            return true;
+        }
+        if (errno != EINTR) return false;
+    }
+#else
+    UNUSED(stream);
+    UNUSED(buffer);
+    UNUSED(size);
+    UNUSED(count);
+    UNREACHABLE; // We never make streams on Windows yet.
+#endif
+}
+
+// Source_Location can't point past SOURCE_FILE_MAX_SIZE, so we don't compile such files.
+static void check_source_file_size(const Source_File *file, const char *path_as_cstr)
+{
+    if (file->size <= SOURCE_FILE_MAX_SIZE) return;
+
+    fprintf(stderr, "Error: Source file '%s' has %zu bytes, but a source file can have at most %zu.\n",
+        path_as_cstr, file->size, SOURCE_FILE_MAX_SIZE);
+    exit(1);
+}
+
 Source_File os_read_entire_file(const char *path_as_cstr)
 {
     Source_File file;
-    file.lines = NULL;
+    file.line_offsets = NULL;
+    file.stream = NULL;
 
     // TODO: We should probably copy these as well.
     file.name = path_get_file_name(path_as_cstr);
     file.path = sv_from_cstr(path_as_cstr);
 
-    // Read the file.
-    FILE *handle = fopen(path_as_cstr, "rb");
-    if (handle == NULL) {
-        goto error;
-    }
-
-    if (fseek(handle, 0, SEEK_END) < 0) {
-        goto error;
+#ifndef _WIN32
+    if (os_map_entire_file(path_as_cstr, &file)) {
+        check_source_file_size(&file, path_as_cstr);
+        return file;
     }
+    if (os_open_stream(path_as_cstr, &file)) return file; // Checked as it gets read, see parser_read_more_input().
+#endif
 
-    long m = ftell(handle);
-    if (m < 0) {
+    // Read until the end instead of asking for the size, so this works on pipes too.
+    FILE *handle = fopen(path_as_cstr, "rb");
+    if (handle == NULL) {
         goto error;
     }
 
-    char *buffer = malloc(m);
+    size_t capacity = 64 * 1024;
+    size_t n = 0;
+    char *buffer = malloc(capacity);
     if (buffer == NULL) {
         goto error;
     }
 
-    if (fseek(handle, 0, SEEK_SET) < 0) {
-        goto error;
-    }
+    while (true) {
+        n += fread(buffer + n, 1, capacity - n, handle);
+        if (ferror(handle)) {
+            goto error;
+        }
+        if (n < capacity) break;
 
-    size_t n = fread(buffer, 1, (size_t) m, handle);
-    if (ferror(handle)) {
-        goto error;
+        capacity *= 2;
+        buffer = realloc(buffer, capacity);
+        if (buffer == NULL) {
+            goto error;
+        }
     }
 
+    fclose(handle);
+
     file.data = buffer;
     file.size = n;
-
+    file.ownership = SOURCE_FILE_MALLOCED;
+    check_source_file_size(&file, path_as_cstr);
     return file;
 
 error:
@@ -120,17 +240,331 @@ error:
     exit(1);
 }
 
-void workspace_typecheck(Workspace *w)
+void source_file_free(Source_File *file)
 {
-    Ast_Declaration **queue = NULL;
-    
+    switch (file->ownership) {
+    case SOURCE_FILE_MALLOCED:
+        free(file->data);
+        break;
+    case SOURCE_FILE_MAPPED:
+#ifndef _WIN32
+        munmap(file->data, file->size);
+#endif
+        break;
+    case SOURCE_FILE_STREAMED:
+#ifndef _WIN32
+        munmap(file->data, SOURCE_STREAM_RESERVE);
+        if (file->stream->fd != STDIN_FILENO) close(file->stream->fd);
+#endif
+        free(file->stream);
+        file->stream = NULL;
+        break;
+    }
+    arrfree(file->line_offsets);
+    file->data = NULL;
+    file->size = 0;
+}
+
+static bool declaration_is_queued_for_typechecking(const Ast_Declaration *decl)
+{
+    return (decl->flags & DECLARATION_IS_CONSTANT) || (decl->flags & DECLARATION_IS_GLOBAL_VARIABLE); // Only constant declarations get async processing.
+}
+
+// Needs typecheck_mutex, and decl must not be being typechecked. Queues the procedure again if it
+// was done already, now that it has more to typecheck.
+static void flatten_parsed_procedure_body(Workspace *w, Ast_Declaration *decl)
+{
+    Ast_Procedure *proc = ast_get(decl->my_value);
+
+    // The body belongs to the procedure's declaration, which may already be done with its signature
+    // and arguments.
+    flatten_stmt_for_typechecking(decl, ast_stmt(proc->body_block));
+    if (decl->flags & DECLARATION_HAS_BEEN_TYPECHECKED) {
+        decl->flags &= ~DECLARATION_HAS_BEEN_TYPECHECKED;
+        arrput(w->typecheck_queue, decl);
+    }
+}
+
+// Called when the typechecker first runs into a procedure whose body was skipped. That can happen
+// on several threads at once, the first one parses the body, the others don't need it to go on.
+void workspace_parse_procedure_body(Workspace *w, Ast_Declaration *decl)
+{
+    Ast_Procedure *proc = ast_get(decl->my_value);
+    if (!proc->body_is_skipped || proc->body_is_claimed) return;
+
+    mutex_lock(&w->typecheck_mutex);
+    bool claimed = !proc->body_is_claimed;
+    proc->body_is_claimed = true;
+    mutex_unlock(&w->typecheck_mutex);
+    if (!claimed) return;
+
+    // Parsing only makes new nodes, so nobody else sees them before they are queued below.
+    Parser *parser = parse_skipped_procedure_body(w, proc);
+    if (parser->reported_error) exit(1);
+
+    mutex_lock(&w->typecheck_mutex);
+
+    // Declarations in the body are typechecked and generated like all the others.
+    For (parser->declarations) {
+        Ast_Declaration *inner = parser->declarations[it];
+        arrput(w->declarations, inner);
+        if (!declaration_is_queued_for_typechecking(inner)) continue;
+
+        flatten_decl_for_typechecking(inner);
+        arrput(w->typecheck_queue, inner);
+    }
+
+    // If another thread is going through the procedure's nodes, it adds the body once it's done.
+    if (decl->is_being_typechecked) {
+        decl->body_is_unflattened = true;
+    } else {
+        flatten_parsed_procedure_body(w, decl);
+    }
+
+    mutex_unlock(&w->typecheck_mutex);
+    parser_free(parser);
+}
+
+static Source_Location stalled_location(Ast_Declaration *decl)
+{
+    Ast_Node node = decl->flattened[decl->typechecking_position];
+    return node.expression ? ast_expr(*node.expression)->location : decl->location;
+}
+
+// Follows the blocked_on chain from a declaration that is still waiting after the queue ran dry.
+static void report_circular_dependency(Workspace *w, Ast_Declaration *decl)
+{
+    // Walking as many steps as there are declarations gets us onto the cycle, if the chain has
+    // one. The chain can lead in from outside of it.
+    for (size_t i = 0; i < arrlenu(w->declarations) && decl->blocked_on; i++) decl = decl->blocked_on;
+
+    if (!decl->blocked_on) {
+        report_error(w, decl->location, "'"SV_Fmt"' is needed, but was never typechecked (this is an internal error).",
+            SV_Arg(ast_ident(decl->ident)->name->name));
+    }
+
+    Ast_Declaration *first = decl;
+    do {
+        report_info(w, stalled_location(decl), "'"SV_Fmt"' needs '"SV_Fmt"' here.",
+            SV_Arg(ast_ident(decl->ident)->name->name), SV_Arg(ast_ident(decl->blocked_on->ident)->name->name));
+        decl = decl->blocked_on;
+    } while (decl != first);
+
+    report_error(w, first->location, "Circular dependency detected: '"SV_Fmt"' depends on itself.", SV_Arg(ast_ident(first->ident)->name->name));
+}
+
+// All threads take declarations from the one typecheck_queue. There are no queues per thread to
+// steal from: a declaration that gets stuck has to go on the wait list of the one it is stuck on,
+// and a thread that finishes one has to wake its waiters, so every declaration takes the lock
+// anyway. Taking the next one from the shared queue is one more line under the same lock.
+typedef struct {
+    Workspace *workspace;
+    Thread_Pool *pool; // NULL if everything is typechecked on the calling thread.
+    int thread_count;
+
+    // Guarded by Workspace.typecheck_mutex:
+    size_t next; // Everything in typecheck_queue before this has been taken by someone.
+    int running_count; // Jobs that were started and haven't finished.
+    Arena **free_arenas; // Workspace.typecheck_arenas that no job is using. @malloced with stb_ds
+    Ast_Declaration **stalled; // Declarations that had to wait at some point. @malloced with stb_ds
+} Typecheck_Scheduler;
+
+static void typecheck_job_proc(void *data);
+
+// Needs typecheck_mutex. Starts a job for everything in the queue that nobody took yet, as long as
+// we have threads for them.
+static void start_typecheck_jobs(Typecheck_Scheduler *s)
+{
+    if (!s->pool) return;
+
+    size_t pending = arrlenu(s->workspace->typecheck_queue) - s->next;
+    while (pending > 0 && s->running_count < s->thread_count) {
+        s->running_count += 1;
+        pending -= 1;
+        thread_pool_add_job(s->pool, typecheck_job_proc, s);
+    }
+}
+
+// Needs typecheck_mutex. Puts everyone waiting for decl back into the queue, if what they wait
+// for is there now. Those that only need a procedure's signature can go on before its body is done.
+static void wake_typecheck_waiters(Typecheck_Scheduler *s, Ast_Declaration *decl)
+{
+    Workspace *w = s->workspace;
+
+    size_t kept = 0;
+    For (decl->waiting) {
+        Ast_Declaration *waiter = decl->waiting[it];
+        if (declaration_is_ready_for(decl, waiter->blocked_on_signature)) {
+            waiter->blocked_on = NULL;
+            arrput(w->typecheck_queue, waiter);
+        } else {
+            decl->waiting[kept++] = waiter;
+        }
+    }
+    arrsetlen(decl->waiting, kept);
+    if (!kept) arrfree(decl->waiting);
+
+    start_typecheck_jobs(s);
+}
+
+// Needs typecheck_mutex, and lets go of it while typechecking. Runs until the queue is empty.
+//
+// Everything in the queue can make progress. A declaration that gets stuck goes on the wait list
+// of the one it is stuck on, and comes back into the queue once what it needs from that one is
+// typechecked, so nothing gets retried while what it waits for hasn't moved.
+// Typechecking can parse bodies, which adds to the queue, so don't hold on to it.
+static void run_typecheck_scheduler(Typecheck_Scheduler *s)
+{
+    Workspace *w = s->workspace;
+
+    while (s->next < arrlenu(w->typecheck_queue)) {
+        Ast_Declaration *decl = w->typecheck_queue[s->next];
+        s->next += 1;
+        if (decl->flags & DECLARATION_HAS_BEEN_TYPECHECKED) continue;
+
+        decl->is_being_typechecked = true;
+        mutex_unlock(&w->typecheck_mutex);
+        Ast_Declaration *blocker = typecheck_declaration(w, decl);
+        mutex_lock(&w->typecheck_mutex);
+        decl->is_being_typechecked = false;
+
+        if (decl->body_is_unflattened) {
+            decl->body_is_unflattened = false;
+            flatten_parsed_procedure_body(w, decl);
+        }
+        start_typecheck_jobs(s); // Parsing bodies may have queued more.
+
+        // Even if we got stuck, a procedure may have gotten as far as its signature.
+        if (decl->waiting) wake_typecheck_waiters(s, decl);
+
+        if (!blocker) continue;
+
+        if (declaration_is_ready_for(blocker, decl->blocked_on_signature)) {
+            // It got there on another thread, which already woke up whoever was waiting then.
+            arrput(w->typecheck_queue, decl);
+        } else {
+            decl->blocked_on = blocker;
+            arrput(blocker->waiting, decl);
+            arrput(s->stalled, decl);
+        }
+    }
+}
+
+static void typecheck_job_proc(void *data)
+{
+    Typecheck_Scheduler *s = data;
+    Workspace *w = s->workspace;
+
+    mutex_lock(&w->typecheck_mutex);
+    Arena *arena = arrpop(s->free_arenas); // There is one for each job that can run at once.
+
+    // Whatever typechecking allocates stays in the AST, so it goes into an arena of our own that
+    // lives as long as the workspace, not into the one that context_arena shares between threads.
+    Push_Arena(arena);
+    run_typecheck_scheduler(s);
+    Pop_Arena();
+
+    arrput(s->free_arenas, arena);
+    s->running_count -= 1;
+    mutex_unlock(&w->typecheck_mutex);
+}
+
+// Some of the bodies that were never used, to be parsed on a thread of their own.
+typedef struct {
+    Workspace *workspace;
+    Ast_Procedure **procedures; // @malloced with stb_ds
+    bool reported_error;
+} Skipped_Body_Check;
+
+// Parses the body into a copy of the procedure, so that the procedure itself stays as it was, and
+// does the same for the procedures declared in there, since their bodies were skipped as well.
+static bool check_syntax_of_skipped_body(Workspace *w, Ast_Procedure *proc)
+{
+    Ast_Procedure *copy = ast_pool_alloc(AST_PROCEDURE); // Nodes can only point at nodes in the pools.
+    *copy = *proc;
+    Parser *parser = parse_skipped_procedure_body(w, copy);
+    bool ok = !parser->reported_error;
+
+    For (parser->declarations) {
+        Ast_Declaration *inner = parser->declarations[it];
+        if (!ok || !(inner->flags & DECLARATION_IS_PROCEDURE)) continue;
+
+        Ast_Procedure *inner_proc = ast_get(inner->my_value);
+        if (inner_proc->body_is_skipped) ok = check_syntax_of_skipped_body(w, inner_proc);
+    }
+    parser_free(parser);
+    return ok;
+}
+
+static void skipped_body_check_job_proc(void *data)
+{
+    Skipped_Body_Check *check = data;
+
+    // Nothing of what we parse is kept, the nodes stay in their pools with nothing pointing at them.
+    Arena arena = {0};
+    Push_Arena(&arena);
+    For (check->procedures) {
+        if (!check_syntax_of_skipped_body(check->workspace, check->procedures[it])) {
+            check->reported_error = true;
+            break;
+        }
+    }
+    Pop_Arena();
+    arena_free(&arena);
+}
+
+// With lazy bodies, the ones nobody used were never parsed, and nothing would tell about their
+// syntax errors. They aren't typechecked or generated, only parsed here and thrown away.
+static void workspace_check_skipped_bodies(Workspace *w)
+{
+    int check_count = os_processor_count();
+    Skipped_Body_Check *checks = calloc(check_count, sizeof(*checks));
+
+    size_t skipped_count = 0;
     For (w->declarations) {
         Ast_Declaration *decl = w->declarations[it];
+        if (!(decl->flags & DECLARATION_IS_PROCEDURE)) continue;
+
+        Ast_Procedure *proc = ast_get(decl->my_value);
+        if (!proc->body_is_skipped || proc->body_block) continue;
+
+        Skipped_Body_Check *check = &checks[skipped_count % check_count];
+        check->workspace = w;
+        arrput(check->procedures, proc);
+        skipped_count += 1;
+    }
 
-        if (!(decl->flags & DECLARATION_IS_CONSTANT) && !(decl->flags & DECLARATION_IS_GLOBAL_VARIABLE)) continue; // Only constant declarations get async processing.
+    bool reported_error = false;
+    if (skipped_count > 0) {
+        int job_count = (int)Min(size_t, skipped_count, (size_t)check_count);
+
+        Thread_Pool pool;
+        thread_pool_init(&pool, job_count);
+        for (int i = 0; i < job_count; i++) thread_pool_add_job(&pool, skipped_body_check_job_proc, &checks[i]);
+        thread_pool_wait(&pool);
+        thread_pool_free(&pool);
+
+        for (int i = 0; i < job_count; i++) {
+            if (checks[i].reported_error) reported_error = true;
+            arrfree(checks[i].procedures);
+        }
+    }
+    free(checks);
+
+    if (reported_error) exit(1);
+}
+
+void workspace_typecheck(Workspace *w)
+{
+    // Bodies parsed from here on add their declarations to the end, they queue them themselves.
+    size_t count = arrlenu(w->declarations);
+    for (size_t it = 0; it < count; it++) {
+        Ast_Declaration *decl = w->declarations[it];
+
+        if (!declaration_is_queued_for_typechecking(decl)) continue;
 
         flatten_decl_for_typechecking(decl);
-        arrput(queue, decl);
+        arrput(w->typecheck_queue, decl);
 #if 0
         String_Builder sb = {0};
         print_decl_to_builder(&sb, decl, 0);
@@ -139,27 +573,208 @@ void workspace_typecheck(Workspace *w)
             Ast_Node node = decl->flattened[it];
             sb_append_cstr(&sb, ">>> ");
             if (node.expression) {
-                sb_print(&sb, "[%d] ", (*node.expression)->kind);
-                print_expr_to_builder(&sb, *node.expression, 0);
+                sb_print(&sb, "[%d] ", ast_expr(*node.expression)->kind);
+                print_expr_to_builder(&sb, ast_expr(*node.expression), 0);
             }
-            if (node.statement)  print_stmt_to_builder(&sb, node.statement, 0);
+            if (node.statement)  print_stmt_to_builder(&sb, ast_stmt(node.statement), 0);
             sb_append_cstr(&sb, "\n");
         }
         printf(SV_Fmt, SV_Arg(sb));
 #endif
     }
     
-    while (arrlenu(queue)) {
-        size_t i = 0;
-        while (i < arrlenu(queue)) {
-            typecheck_declaration(w, queue[i]);
-            if (queue[i]->flags & DECLARATION_HAS_BEEN_TYPECHECKED) {
-                arrdelswap(queue, i);
-            } else {
-                i += 1;
-            }
+    // Nothing refers to main by name, so nothing would ask for its body.
+    if (w->lazy_bodies) {
+        Ast_Declaration *main_decl = find_declaration_in_block(w->global_block, workspace_intern_cstr(w, "main"));
+        if (main_decl && (main_decl->flags & DECLARATION_IS_PROCEDURE)) workspace_parse_procedure_body(w, main_decl);
+    }
+
+    Typecheck_Scheduler s = {0};
+    s.workspace = w;
+    s.thread_count = os_processor_count();
+
+    Thread_Pool pool;
+    if (s.thread_count > 1) {
+        w->typecheck_arenas = calloc(s.thread_count, sizeof(Arena));
+        for (int i = 0; i < s.thread_count; i++) arrput(s.free_arenas, &w->typecheck_arenas[i]);
+
+        thread_pool_init(&pool, s.thread_count);
+        s.pool = &pool;
+
+        mutex_lock(&w->typecheck_mutex);
+        start_typecheck_jobs(&s);
+        mutex_unlock(&w->typecheck_mutex);
+
+        thread_pool_wait(&pool);
+        thread_pool_free(&pool);
+        arrfree(s.free_arenas);
+    } else {
+        mutex_lock(&w->typecheck_mutex);
+        run_typecheck_scheduler(&s);
+        mutex_unlock(&w->typecheck_mutex);
+    }
+    arrfree(w->typecheck_queue);
+
+    // The queue ran dry, so whatever is still waiting is waiting on a cycle.
+    For (s.stalled) {
+        if (!(s.stalled[it]->flags & DECLARATION_HAS_BEEN_TYPECHECKED)) report_circular_dependency(w, s.stalled[it]);
+    }
+    arrfree(s.stalled);
+
+    if (w->lazy_bodies) workspace_check_skipped_bodies(w);
+}
+
+static void llvm_build_procedure(Workspace *w, Ast_Declaration *decl)
+{
+    Llvm *llvm = llvm_current(w);
+    Ast_Procedure *proc = ast_get(decl->my_value);
+
+    LLVMValueRef function = llvm_get_global_value(w, proc->llvm_value);
+    assert(function); // Should've been added in the pre-pass.
+
+    LLVMBasicBlockRef entry = LLVMAppendBasicBlockInContext(llvm->context, function, "entry");
+    LLVMPositionBuilderAtEnd(llvm->builder, entry);
+    llvm_build_statement(w, function, ast_stmt(ast_block(proc->body_block)->parent)); // Arguments.
+    llvm_build_statement(w, function, ast_stmt(proc->body_block));
+
+    // TODO: typechecker doesn't detect missing returns of non-void functions.
+
+    if (ast_type(ast_type(proc->lambda_type)->lambda.return_type) == w->type_def_void) {
+        if (LLVMGetBasicBlockTerminator(LLVMGetLastBasicBlock(function)) == NULL) {
+            LLVMBuildRetVoid(llvm->builder);
+        }
+    }
+
+    if (w->verify_llvm && LLVMVerifyFunction(function, LLVMPrintMessageAction)) {
+        printf("===============================\n");
+        LLVMDumpValue(function);
+        printf("===============================\n");
+        exit(1);
+    }
+}
+
+// Some of the procedure bodies, built on a thread of their own into a context of their own.
+typedef struct {
+    Workspace *workspace;
+    int index;
+    Ast_Declaration **procedures; // @malloced with stb_ds
+    size_t weight; // How many nodes the procedures had when they were typechecked, a guess at how long they take to build.
+    LLVMMemoryBufferRef bitcode; // Modules can only be linked within one context, so the result gets read back into Workspace.llvm.
+} Llvm_Partition;
+
+static void llvm_partition_job_proc(void *data)
+{
+    Llvm_Partition *partition = data;
+    Workspace *w = partition->workspace;
+
+    Llvm llvm = {0};
+    llvm_create_module(&llvm, tprint("%s.%d", w->name, partition->index), LLVMGetTarget(w->llvm.module));
+    LLVMSetDataLayout(llvm.module, LLVMGetDataLayoutStr(w->llvm.module));
+    llvm_partition = &llvm;
+
+    // Declare every procedure and global we could refer to, under the name it got in the workspace
+    // module. Where they are defined doesn't matter, linking puts them together.
+    For (w->declarations) {
+        Ast_Declaration *decl = w->declarations[it];
+        size_t length;
+
+        if (decl->flags & DECLARATION_IS_PROCEDURE) {
+            Ast_Procedure *proc = ast_get(decl->my_value);
+            if (!proc->llvm_value) continue; // Never used, so never parsed or typechecked.
+
+            const char *name = LLVMGetValueName2(proc->llvm_value, &length);
+            LLVMValueRef function = LLVMAddFunction(llvm.module, name, llvm_get_type(w, ast_type(proc->lambda_type)));
+            LLVMSetFunctionCallConv(function, LLVMCCallConv);
+            continue;
         }
+
+        if (decl->flags & DECLARATION_IS_GLOBAL_VARIABLE) {
+            const char *name = LLVMGetValueName2(decl->llvm_value, &length);
+            LLVMAddGlobal(llvm.module, llvm_get_type(w, ast_type(decl->my_type)), name); // No initializer, so it is external.
+        }
+    }
+
+    For (partition->procedures) llvm_build_procedure(w, partition->procedures[it]);
+
+    partition->bitcode = LLVMWriteBitcodeToMemoryBuffer(llvm.module);
+
+    llvm_partition = NULL;
+    LLVMDisposeBuilder(llvm.builder);
+    LLVMDisposeModule(llvm.module);
+    LLVMContextDispose(llvm.context);
+}
+
+// Every partition only reads the workspace module, which is why the globals and their initializers
+// stay in there, and is linked into it afterwards.
+static void llvm_build_partitions(Workspace *w, Ast_Declaration **procedures, int partition_count)
+{
+    Llvm_Partition *partitions = calloc(partition_count, sizeof(*partitions));
+    for (int i = 0; i < partition_count; i++) {
+        partitions[i].workspace = w;
+        partitions[i].index = i;
+    }
+
+    // @Speed: Sorting by weight first would balance better.
+    For (procedures) {
+        Ast_Declaration *decl = procedures[it];
+
+        Llvm_Partition *lightest = &partitions[0];
+        for (int i = 1; i < partition_count; i++) {
+            if (partitions[i].weight < lightest->weight) lightest = &partitions[i];
+        }
+        arrput(lightest->procedures, decl);
+        lightest->weight += arrlenu(decl->flattened);
+    }
+
+    Thread_Pool pool;
+    thread_pool_init(&pool, Min(int, partition_count, os_processor_count()));
+    for (int i = 0; i < partition_count; i++) thread_pool_add_job(&pool, llvm_partition_job_proc, &partitions[i]);
+    thread_pool_wait(&pool);
+    thread_pool_free(&pool);
+
+    // Linking replaces our declarations with the definitions, so we look them up again afterwards.
+    Ast_Declaration **globals = NULL;
+    const char **names = NULL;
+    For (w->declarations) {
+        Ast_Declaration *decl = w->declarations[it];
+        if (!(decl->flags & (DECLARATION_IS_PROCEDURE | DECLARATION_IS_GLOBAL_VARIABLE))) continue;
+        if (!decl->llvm_value) continue;
+
+        size_t length;
+        const char *name = LLVMGetValueName2(decl->llvm_value, &length);
+        arrput(globals, decl);
+        arrput(names, arena_sv_to_cstr(&temporary_arena, sv_from_parts(name, length)));
+    }
+
+    for (int i = 0; i < partition_count; i++) {
+        LLVMModuleRef module = NULL;
+        if (LLVMParseBitcodeInContext2(w->llvm.context, partitions[i].bitcode, &module)) {
+            fprintf(stderr, "Error: Could not read back LLVM partition %d (this is an internal error).\n", i);
+            exit(1);
+        }
+        LLVMDisposeMemoryBuffer(partitions[i].bitcode);
+
+        if (LLVMLinkModules2(w->llvm.module, module)) { // This takes the module.
+            fprintf(stderr, "Error: Could not link LLVM partition %d (this is an internal error).\n", i);
+            exit(1);
+        }
+        arrfree(partitions[i].procedures);
+    }
+    free(partitions);
+
+    For (globals) {
+        Ast_Declaration *decl = globals[it];
+        if (decl->flags & DECLARATION_IS_PROCEDURE) {
+            Ast_Procedure *proc = ast_get(decl->my_value);
+            decl->llvm_value = LLVMGetNamedFunction(w->llvm.module, names[it]);
+            proc->llvm_value = decl->llvm_value;
+        } else {
+            decl->llvm_value = LLVMGetNamedGlobal(w->llvm.module, names[it]);
+        }
+        assert(decl->llvm_value);
     }
+    arrfree(globals);
+    arrfree(names);
 }
 
 void workspace_llvm(Workspace *w)
@@ -169,12 +784,13 @@ void workspace_llvm(Workspace *w)
         Ast_Declaration *decl = w->declarations[it];
 
         if (decl->flags & DECLARATION_IS_PROCEDURE) {
-            Ast_Procedure *proc = xx decl->my_value;
+            Ast_Procedure *proc = ast_get(decl->my_value);
+            if (proc->body_is_skipped && !proc->body_block) continue; // Never used, so never parsed or typechecked.
 
-            LLVMTypeRef function_type = llvm_get_type(w, proc->lambda_type);
+            LLVMTypeRef function_type = llvm_get_type(w, ast_type(proc->lambda_type));
             assert(function_type);
 
-            const char *name = arena_sv_to_cstr(context_arena, decl->ident->name);
+            const char *name = ast_ident(decl->ident)->name->name.data;
             LLVMValueRef function = LLVMAddFunction(w->llvm.module, name, function_type);
             LLVMSetFunctionCallConv(function, LLVMCCallConv); // Not sure if we need this, but...
 
@@ -186,50 +802,37 @@ void workspace_llvm(Workspace *w)
         if (decl->flags & DECLARATION_IS_GLOBAL_VARIABLE) {
             assert(!(decl->flags & DECLARATION_IS_CONSTANT));
 
-            const char *name = arena_sv_to_cstr(context_arena, decl->ident->name);
+            const char *name = ast_ident(decl->ident)->name->name.data;
 
-            LLVMTypeRef type = llvm_get_type(w, decl->my_type); assert(type);
+            LLVMTypeRef type = llvm_get_type(w, ast_type(decl->my_type)); assert(type);
             LLVMValueRef global = LLVMAddGlobal(w->llvm.module, type, name);
             LLVMSetLinkage(global, LLVMExternalLinkage);
-            LLVMSetInitializer(global, llvm_build_expression(w, decl->my_value));
+            LLVMSetInitializer(global, llvm_build_expression(w, ast_expr(decl->my_value)));
 
             decl->llvm_value = global;
         }
     }
     
-    // Now build the LLVM IR.
-    For (w->declarations) {
-        Ast_Declaration *decl = w->declarations[it];
-
-        if (decl->flags & DECLARATION_IS_PROCEDURE) {           
-            Ast_Procedure *proc = xx decl->my_value;
-
-            if (!proc->body_block) continue; // Has no body (most likely #foreign or a bug).
-
-            LLVMValueRef function = proc->llvm_value;
-            assert(function); // Should've been added in the pre-pass.
-
-            LLVMBasicBlockRef entry = LLVMAppendBasicBlock(function, "entry");
-            LLVMPositionBuilderAtEnd(w->llvm.builder, entry);
-            llvm_build_statement(w, function, xx proc->body_block->parent); // Arguments.
-            llvm_build_statement(w, function, xx proc->body_block);
+    // Now build the LLVM IR. The declarations lie next to each other in their pool, so we go
+    // through that instead of following w->declarations. The order of the functions in the module
+    // was already set above.
+    Ast_Declaration **procedures = NULL; // The ones with bodies.
+    uint32_t declaration_count = ast_pool_count(AST_POOL_DECLARATION);
+    for (uint32_t i = 0; i < declaration_count; i++) {
+        Ast_Declaration *decl = ast_decl(ast_pool_handle(AST_POOL_DECLARATION, i));
+        if (!(decl->flags & DECLARATION_IS_PROCEDURE) || !decl->llvm_value) continue; // Not predeclared above.
 
-            // TODO: typechecker doesn't detect missing returns of non-void functions.
-
-            if (proc->lambda_type->lambda.return_type == w->type_def_void) {
-                if (LLVMGetBasicBlockTerminator(LLVMGetLastBasicBlock(function)) == NULL) {
-                    LLVMBuildRetVoid(w->llvm.builder);
-                }
-            }
+        Ast_Procedure *proc = ast_get(decl->my_value);
+        if (proc->body_block) arrput(procedures, decl); // Has no body (most likely #foreign or a bug).
+    }
 
-            if (LLVMVerifyFunction(function, LLVMPrintMessageAction)) {
-                printf("===============================\n");
-                LLVMDumpValue(function);
-                printf("===============================\n");
-                exit(1);
-            }
-        }
+    int partition_count = Min(int, w->llvm_partition_count, (int)arrlen(procedures));
+    if (partition_count > 1) {
+        llvm_build_partitions(w, procedures, partition_count);
+    } else {
+        For (procedures) llvm_build_procedure(w, procedures[it]);
     }
+    arrfree(procedures);
 }
 
 String_View path_trim_ext(String_View path)
@@ -238,49 +841,233 @@ String_View path_trim_ext(String_View path)
     while (i < path.count && path.data[path.count-i-1] != '.') {
         i += 1;
     }
-    if (path.data[path.count-i-1] == '.') i += 1;
+    if (i == path.count) return path; // No extension, like stdin.
+    i += 1;
     return sv_from_parts(path.data, path.count - i);
 }
 
+static void llvm_emit_file(LLVMTargetMachineRef target_machine, LLVMModuleRef module, char *path, LLVMCodeGenFileType file_type)
+{
+    char *error_message = NULL;
+    if (LLVMTargetMachineEmitToFile(target_machine, module, path, file_type, &error_message) != 0) {
+        const char *what = (file_type == LLVMAssemblyFile) ? "assembly" : "object";
+        fprintf(stderr, "Error: Could not output %s file '%s': %s.\n", what, path, error_message);
+        LLVMDisposeMessage(error_message);
+    }
+}
+
+// Code generation for one file, on a copy of the module in a context of its own.
+typedef struct {
+    Workspace *workspace;
+    LLVMMemoryBufferRef bitcode; // Shared by all jobs, they only read it.
+    char *path;
+    LLVMCodeGenFileType file_type;
+} Emit_Job;
+
+static void emit_job_proc(void *data)
+{
+    Emit_Job *job = data;
+
+    LLVMContextRef context = LLVMContextCreate();
+    LLVMContextSetOpaquePointers(context, 1);
+
+    LLVMModuleRef module = NULL;
+    if (LLVMParseBitcodeInContext2(context, job->bitcode, &module)) {
+        fprintf(stderr, "Error: Could not copy the LLVM module for '%s' (this is an internal error).\n", job->path);
+        exit(1);
+    }
+
+    LLVMTargetMachineRef target_machine = llvm_create_target_machine(job->workspace, LLVMGetTarget(module));
+    if (target_machine) {
+        llvm_emit_file(target_machine, module, job->path, job->file_type);
+        LLVMDisposeTargetMachine(target_machine);
+    }
+
+    LLVMDisposeModule(module);
+    LLVMContextDispose(context);
+}
+
 void workspace_save(Workspace *w)
 {
     assert(arrlenu(w->files) > 0);
 
     String_View path = path_trim_ext(w->files[0].path);
-    
+
+    char *bitcode_path = tprint(SV_Fmt".bc", SV_Arg(path));
     char *llvm_path = tprint(SV_Fmt".llvm", SV_Arg(path));
     char *obj_path = tprint(SV_Fmt".o", SV_Arg(path));
     char *asm_path = tprint(SV_Fmt".asm", SV_Arg(path));
 
-    char *error_message = NULL;
-    LLVMPrintModuleToFile(w->llvm.module, llvm_path, &error_message);
-    if (error_message) {
-        fprintf(stderr, "Error: Could not output LLVM module to file '%s': %s.\n", llvm_path, error_message);
-        LLVMDisposeMessage(error_message);
+    // Every EmitToFile runs all of code generation, which also changes the module. So if we want
+    // more than one file, each of those gets generated from its own copy at the same time, while we
+    // write out the rest here. Otherwise the module is used as it is.
+    Emit_Job jobs[2];
+    size_t job_count = 0;
+    if (w->outputs & OUTPUT_ASSEMBLY) jobs[job_count++] = (Emit_Job){ w, NULL, asm_path, LLVMAssemblyFile };
+    if (w->outputs & OUTPUT_OBJECT)   jobs[job_count++] = (Emit_Job){ w, NULL, obj_path, LLVMObjectFile };
+
+    bool several_outputs = (w->outputs & (w->outputs - 1)) != 0; // More than one bit is set.
+    bool concurrent = job_count > 0 && several_outputs && os_processor_count() > 1;
+
+    Thread_Pool pool;
+    LLVMMemoryBufferRef bitcode = NULL;
+    if (concurrent) {
+        bitcode = LLVMWriteBitcodeToMemoryBuffer(w->llvm.module);
+        thread_pool_init(&pool, Min(int, (int)job_count, os_processor_count()));
+        for (size_t i = 0; i < job_count; i++) {
+            jobs[i].bitcode = bitcode;
+            thread_pool_add_job(&pool, emit_job_proc, &jobs[i]);
+        }
     }
 
-    if (LLVMTargetMachineEmitToFile(w->llvm.target_machine, w->llvm.module, asm_path, LLVMAssemblyFile, &error_message) != 0) {
-        fprintf(stderr, "Error: Could not output assembly file '%s': %s.\n", asm_path, error_message);
-        LLVMDisposeMessage(error_message);
+    if (w->outputs & OUTPUT_BITCODE) {
+        if (LLVMWriteBitcodeToFile(w->llvm.module, bitcode_path) != 0) {
+            fprintf(stderr, "Error: Could not output LLVM bitcode to file '%s'.\n", bitcode_path);
+        }
     }
 
-    if (LLVMTargetMachineEmitToFile(w->llvm.target_machine, w->llvm.module, obj_path, LLVMObjectFile, &error_message) != 0) {
-        fprintf(stderr, "Error: Could not output object file '%s': %s.\n", obj_path, error_message);
-        LLVMDisposeMessage(error_message);
+    if (w->outputs & OUTPUT_IR) {
+        char *error_message = NULL;
+        LLVMPrintModuleToFile(w->llvm.module, llvm_path, &error_message);
+        if (error_message) {
+            fprintf(stderr, "Error: Could not output LLVM module to file '%s': %s.\n", llvm_path, error_message);
+            LLVMDisposeMessage(error_message);
+        }
+    }
+
+    if (concurrent) {
+        thread_pool_wait(&pool);
+        thread_pool_free(&pool);
+        LLVMDisposeMemoryBuffer(bitcode);
+    } else {
+        for (size_t i = 0; i < job_count; i++) {
+            llvm_emit_file(w->llvm.target_machine, w->llvm.module, jobs[i].path, jobs[i].file_type);
+        }
+    }
+}
+
+#define ATOM_TABLE_INITIAL_CAPACITY 64 // Per shard.
+
+static void atom_table_insert_without_growing(Atom_Table_Shard *shard, Atom *atom)
+{
+    size_t mask = shard->capacity - 1;
+    size_t slot = atom->hash & mask;
+    while (shard->slots[slot]) slot = (slot + 1) & mask;
+    shard->slots[slot] = atom;
+    shard->count += 1;
+}
+
+static void atom_table_grow(Atom_Table_Shard *shard)
+{
+    Atom **old_slots = shard->slots;
+    size_t old_capacity = shard->capacity;
+
+    shard->capacity = old_capacity ? old_capacity * 2 : ATOM_TABLE_INITIAL_CAPACITY;
+    shard->slots = calloc(shard->capacity, sizeof(Atom *));
+    shard->count = 0;
+    assert(shard->slots != NULL && "Ran out of memory");
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_slots[i]) atom_table_insert_without_growing(shard, old_slots[i]);
+    }
+    free(old_slots);
+}
+
+void atom_table_init(Atom_Table *table)
+{
+    for (int i = 0; i < (1 << ATOM_TABLE_SHARD_BITS); i++) {
+        table->shards[i] = (Atom_Table_Shard){0};
+        mutex_init(&table->shards[i].mutex);
+    }
+}
+
+void atom_table_free(Atom_Table *table)
+{
+    for (int i = 0; i < (1 << ATOM_TABLE_SHARD_BITS); i++) {
+        Atom_Table_Shard *shard = &table->shards[i];
+        arena_free(&shard->arena);
+        free(shard->slots);
+        mutex_destroy(&shard->mutex);
+    }
+}
+
+// The hash is passed in because the lexer already computed it for every identifier token.
+Atom *workspace_intern(Workspace *w, String_View name, uint32_t hash)
+{
+    // The shard comes from the top bits and the slot from the bottom ones, so the names in a shard
+    // still spread out over its slots.
+    Atom_Table_Shard *shard = &w->atoms.shards[hash >> (32 - ATOM_TABLE_SHARD_BITS)];
+    mutex_lock(&shard->mutex);
+
+    if (shard->capacity) {
+        size_t mask = shard->capacity - 1;
+        for (size_t slot = hash & mask; shard->slots[slot]; slot = (slot + 1) & mask) {
+            Atom *atom = shard->slots[slot];
+            if (atom->hash == hash && sv_eq(atom->name, name)) {
+                mutex_unlock(&shard->mutex);
+                return atom;
+            }
+        }
     }
+
+    // Keep the load factor under a half so probe sequences stay short.
+    if (2*(shard->count + 1) > shard->capacity) atom_table_grow(shard);
+
+    Atom *atom = arena_alloc(&shard->arena, sizeof(Atom) + name.count + 1);
+    char *data = (char *)(atom + 1);
+    memcpy(data, name.data, name.count);
+    data[name.count] = '\0';
+    atom->name = sv_from_parts(data, name.count);
+    atom->hash = hash;
+
+    atom_table_insert_without_growing(shard, atom);
+    mutex_unlock(&shard->mutex);
+    return atom;
+}
+
+Atom *workspace_intern_cstr(Workspace *w, const char *name)
+{
+    size_t count = strlen(name);
+    return workspace_intern(w, sv_from_parts(name, count), hash_identifier(name, count));
 }
 
 void workspace_init(Workspace *w, const char *name)
 {
+    ast_pools_init();
+
     w->name = name;
     w->llvm = (Llvm){0};
-    w->global_block = context_alloc(sizeof(Ast_Block));
+    w->global_block = ast_alloc((Source_Location){0}, AST_BLOCK);
     w->declarations = NULL;
+    w->typecheck_queue = NULL;
+    mutex_init(&w->typecheck_mutex);
+    w->typecheck_arenas = NULL;
     w->files = NULL;
+    w->parse_jobs = NULL;
+    mutex_init(&w->files_mutex);
+    w->parse_pool = NULL;
+    w->pretokenize = false;
+    w->lazy_bodies = false;
+    w->llvm_partition_count = 1;
+    w->outputs = OUTPUT_IR | OUTPUT_ASSEMBLY | OUTPUT_OBJECT;
+    w->optimization_level = 2;
+    w->optimize_for_size = false;
+    w->verify_llvm = true;
+    w->target_triple = NULL;
+    w->target_cpu = "";
+    w->target_features = "";
+    w->timings = (Workspace_Timings){0};
+
+    atom_table_init(&w->atoms);
+    w->atom_it       = workspace_intern_cstr(w, "it");
+    w->atom_data     = workspace_intern_cstr(w, "data");
+    w->atom_count    = workspace_intern_cstr(w, "count");
+    w->atom_capacity = workspace_intern_cstr(w, "capacity");
 
     // Create type definitions for built-in types.
+    w->type_def_type = NULL; // Not there yet for its own definition, which gets it right after.
     w->type_def_type = make_type_definition(w, "Type", TYPE_DEF_LITERAL, 8);
-    w->type_def_type->_expression.inferred_type = w->type_def_type; // And on and on and on...
+    w->type_def_type->_expression.inferred_type = ast_handle(w->type_def_type); // And on and on and on...
 
     w->type_def_int = make_type_definition_integer(w, "int", 8, true,  LLONG_MIN, LLONG_MAX);
     w->type_def_u8  = make_type_definition_integer(w, "u8",  1, false, 0,         UCHAR_MAX);
@@ -303,26 +1090,245 @@ void workspace_init(Workspace *w, const char *name)
     w->type_def_void = make_type_definition(w, "void", TYPE_DEF_LITERAL, 0);
 }
 
-inline void workspace_parse_entire_file(Workspace *w, Source_File file)
+// Files at least twice this big get lexed on several threads, one piece of about this size each.
+#define PARALLEL_LEX_CHUNK_SIZE (1024*1024)
+
+typedef struct {
+    Parse_Job *parse_job;
+    Token_Chunk *chunk;
+} Lex_Job;
+
+static void parse_file(Parse_Job *job)
 {
-    // Add the file to the workspace.
-    int fid = arrlen(w->files);
-    arrput(w->files, file);
+    Workspace *w = job->workspace;
+    Parser *parser = job->parser;
 
-    // Create a parser and do some parsing!
-    Parser *parser = parser_init(w, fid);
-    parser->current_block = w->global_block;
+    Push_Arena(&job->arena);
+
+    double start = get_time_in_seconds();
+    if (job->chunks) {
+        // Lex the file in one piece after all if a chunk had errors, so they get reported in order.
+        if (!parser_join_token_chunks(parser, job->chunks, job->chunk_count)) parser_tokenize_entire_file(parser);
+        job->timings.token_count = arrlen(parser->token_stream->types);
+
+        start = get_time_in_seconds();
+        job->timings.lex_seconds = start - job->lex_start;
+    } else if (w->pretokenize) {
+        parser_tokenize_entire_file(parser);
+        job->timings.token_count = arrlen(parser->token_stream->types);
 
+        double lexed = get_time_in_seconds();
+        job->timings.lex_seconds = lexed - start;
+        start = lexed;
+    }
+
+    // #load'ed files just get queued up, they don't block us.
     parse_toplevel(parser);
-    if (parser->reported_error) exit(1);
+    job->timings.parse_seconds = get_time_in_seconds() - start;
+
+    Pop_Arena();
+}
+
+static void lex_job_proc(void *data)
+{
+    Lex_Job *lex_job = data;
+    Parse_Job *job = lex_job->parse_job;
+    Workspace *w = job->workspace;
+
+    token_chunk_lex(lex_job->chunk);
+
+    mutex_lock(&w->files_mutex);
+    job->chunks_remaining -= 1;
+    bool was_last = job->chunks_remaining == 0;
+    mutex_unlock(&w->files_mutex);
+
+    if (was_last) parse_file(job);
+}
+
+static void parse_job_proc(void *data)
+{
+    Parse_Job *job = data;
+    Workspace *w = job->workspace;
+
+    if (job->path) {
+        Source_File file = os_read_entire_file(job->path);
+        mutex_lock(&w->files_mutex);
+        w->files[job->file_index] = file;
+        mutex_unlock(&w->files_mutex);
+    }
+
+    // Everything this file allocates goes into its own arena, so the workers don't share one.
+    Push_Arena(&job->arena);
+
+    Parser *parser = parser_init(w, job->file_index);
+    parser->current_block = w->global_block;
+    job->parser = parser;
+
+    size_t chunk_count = (size_t)(parser->input_end - parser->cursor) / PARALLEL_LEX_CHUNK_SIZE;
+    chunk_count = Min(size_t, chunk_count, (size_t)os_processor_count());
+    if (chunk_count > 1) {
+        job->lex_start = get_time_in_seconds();
+        job->chunk_count = parser_split_into_token_chunks(parser, chunk_count, &job->chunks);
+        job->chunks_remaining = job->chunk_count;
+
+        Lex_Job *lex_jobs = context_alloc(job->chunk_count * sizeof(*lex_jobs));
+        for (size_t i = 0; i < job->chunk_count; i++) lex_jobs[i] = (Lex_Job){ job, &job->chunks[i] };
+        Pop_Arena();
+
+        // We lex the first piece ourselves.
+        for (size_t i = 1; i < job->chunk_count; i++) thread_pool_add_job(w->parse_pool, lex_job_proc, &lex_jobs[i]);
+        lex_job_proc(&lex_jobs[0]);
+        return;
+    }
+
+    Pop_Arena();
+    parse_file(job);
+}
+
+static bool os_get_file_identity(const char *path_as_cstr, File_Identity *identity)
+{
+#ifndef _WIN32
+    struct stat statbuf;
+    if (stat(path_as_cstr, &statbuf) < 0) return false;
+
+    identity->device = statbuf.st_dev;
+    identity->inode = statbuf.st_ino;
+    return true;
+#else
+    // TODO: GetFileInformationByHandle() gives us a volume serial number and a file index.
+    UNUSED(path_as_cstr);
+    UNUSED(identity);
+    return false;
+#endif
+}
+
+// Reserves the file index and queues up the parsing. Called from any thread. A file that
+// was loaded before is not parsed again, we return the index it already has.
+static int workspace_queue_file(Workspace *w, Source_File file, const char *path_as_cstr)
+{
+    assert(w->parse_pool && "Files can only be queued while parsing");
+
+    // If we can't stat it we let it through, reading it will report the error.
+    File_Identity identity;
+    bool has_identity = path_as_cstr && os_get_file_identity(path_as_cstr, &identity);
+
+    mutex_lock(&w->files_mutex);
+
+    if (has_identity) {
+        // @Speed: Linear, but programs load tens of files, not thousands.
+        For (w->parse_jobs) {
+            Parse_Job *loaded = w->parse_jobs[it];
+            if (loaded->has_identity && loaded->identity.device == identity.device && loaded->identity.inode == identity.inode) {
+                mutex_unlock(&w->files_mutex);
+                return loaded->file_index;
+            }
+        }
+    }
+
+    // Source_Location only has 16 bits for the file index.
+    if (arrlenu(w->files) >= SOURCE_FILE_MAX_COUNT) {
+        mutex_unlock(&w->files_mutex);
+        fprintf(stderr, "Error: Could not load '%s': A program can have at most %zu files.\n",
+            path_as_cstr ? path_as_cstr : "(string)", SOURCE_FILE_MAX_COUNT);
+        exit(1);
+    }
+
+    Parse_Job *job = malloc(sizeof(*job));
+    memset(job, 0, sizeof(*job));
+    job->workspace = w;
+    if (path_as_cstr) {
+        job->path = arena_sv_to_cstr(&job->arena, sv_from_cstr(path_as_cstr)); // The caller's path is temporary.
+    }
+
+    job->file_index = arrlen(w->files);
+    arrput(w->files, file);
+    arrput(w->parse_jobs, job);
+    job->has_identity = has_identity;
+    if (has_identity) job->identity = identity;
+
+    mutex_unlock(&w->files_mutex);
+
+    thread_pool_add_job(w->parse_pool, parse_job_proc, job);
+    return job->file_index;
+}
+
+inline int workspace_load_file(Workspace *w, const char *path_as_cstr)
+{
+    return workspace_queue_file(w, (Source_File){0}, path_as_cstr);
+}
+
+// Adds the top-level declarations of a file to the global block, and the files it #loads at the
+// place where they were loaded. This gives the same order as parsing everything on one thread
+// would, independent of which file finished first.
+static void workspace_merge_parsed_file(Workspace *w, int fid)
+{
+    Parse_Job *job = w->parse_jobs[fid];
+    if (job->merged) return; // Loaded earlier, or we are in the middle of merging it (#load cycle).
+    job->merged = true;
+
+    Parser *parser = job->parser;
+    size_t merged = 0; // parser->declarations[0..merged) are in w->declarations already.
+
+    For (parser->toplevel) {
+        Toplevel_Entry entry = parser->toplevel[it];
+        if (entry.declaration) {
+            add_to_scope_and_check_redeclaration(parser, w->global_block, entry.declaration);
+            continue;
+        }
+
+        for (; merged < entry.declaration_count; merged++) arrput(w->declarations, parser->declarations[merged]);
+        workspace_merge_parsed_file(w, entry.loaded_file_index);
+    }
+    for (; merged < arrlenu(parser->declarations); merged++) arrput(w->declarations, parser->declarations[merged]);
+}
+
+// Returns true if any of the parsers we haven't freed yet reported an error.
+static bool workspace_any_parse_errors(Workspace *w)
+{
+    For (w->parse_jobs) {
+        Parser *parser = w->parse_jobs[it]->parser;
+        if (parser && parser->reported_error) return true;
+    }
+    return false;
+}
+
+static void workspace_parse_all(Workspace *w, Source_File file, const char *path_as_cstr)
+{
+    double start = get_time_in_seconds();
+
+    Thread_Pool pool;
+    thread_pool_init(&pool, os_processor_count());
+    w->parse_pool = &pool;
+
+    int fid = workspace_queue_file(w, file, path_as_cstr);
+    thread_pool_wait(&pool);
+
+    w->parse_pool = NULL;
+    thread_pool_free(&pool);
+
+    if (workspace_any_parse_errors(w)) exit(1);
+
+    workspace_merge_parsed_file(w, fid);
+    if (workspace_any_parse_errors(w)) exit(1); // Redeclared globals.
+
+    For (w->parse_jobs) {
+        Parse_Job *job = w->parse_jobs[it];
+        if (!job->parser) continue; // From an earlier call.
+
+        w->timings.lex_seconds   += job->timings.lex_seconds;
+        w->timings.parse_seconds += job->timings.parse_seconds;
+        w->timings.token_count   += job->timings.token_count;
+
+        parser_free(job->parser);
+        job->parser = NULL;
+    }
 
-    free(parser);
+    w->timings.parse_wall_seconds += get_time_in_seconds() - start;
 }
 
 inline void workspace_add_file(Workspace *w, const char *path_as_cstr)
 {
-    Source_File file = os_read_entire_file(path_as_cstr);
-    workspace_parse_entire_file(w, file);
+    workspace_parse_all(w, (Source_File){0}, path_as_cstr);
 }
 
 inline void workspace_add_string(Workspace *w, String_View input)
@@ -332,8 +1338,11 @@ inline void workspace_add_string(Workspace *w, String_View input)
     file.path = (String_View)SV_STATIC("(added from a string)");
     file.data = malloc(input.count);
     file.size = input.count;
+    file.ownership = SOURCE_FILE_MALLOCED;
     memcpy(file.data, input.data, input.count);
-    file.lines = NULL;
+    file.stream = NULL;
+    file.line_offsets = NULL;
+    check_source_file_size(&file, "(string)");
 
-    workspace_parse_entire_file(w, file);
+    workspace_parse_all(w, file, NULL);
 }
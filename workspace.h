@@ -4,14 +4,16 @@
 #include <llvm-c/Target.h>
 #include <llvm-c/TargetMachine.h>
 #include <llvm-c/Analysis.h>
+#include <llvm-c/BitReader.h>
+#include <llvm-c/BitWriter.h>
+#include <llvm-c/Linker.h>
 
 #include <llvm-c/ExecutionEngine.h>
-#include <llvm-c/Transforms/Utils.h>
-#include <llvm-c/Transforms/InstCombine.h>
-#include <llvm-c/Transforms/Scalar.h>
+#include <llvm-c/Transforms/PassBuilder.h>
 
 #include "parser.h"
 #include "typecheck.h"
+#include "thread_pool.h"
 
 typedef struct {
     LLVMContextRef context;
@@ -25,13 +27,98 @@ typedef struct {
     LLVMTypeRef dynamic_array_type;
 } Llvm;
 
+typedef struct {
+    _Alignas(64) Mutex mutex; // On its own cache line, so threads locking neighbouring shards don't slow each other down.
+    Arena arena; // The atoms and their names, these live as long as the workspace.
+    Atom **slots; // Open addressing with linear probing. @malloced
+    size_t capacity; // Always a power of two.
+    size_t count;
+} Atom_Table_Shard;
+
+// Files are parsed on several threads, and they all intern their identifiers here. The table is split
+// by the top bits of the hash, and each shard has its own lock, so two threads only wait on each other
+// when their names land in the same shard. See workspace_intern().
+#define ATOM_TABLE_SHARD_BITS 6
+
+typedef struct {
+    Atom_Table_Shard shards[1 << ATOM_TABLE_SHARD_BITS];
+} Atom_Table;
+
+// Lexing and parsing times are summed over all files, so with files parsed in parallel they add up
+// to more than the wall time.
+typedef struct {
+    double lex_seconds; // Only measured on its own when a file is lexed up front, otherwise it is part of parsing.
+    double parse_seconds;
+    double parse_wall_seconds; // From the first file being queued until the last one is merged.
+    size_t token_count; // Only counted when a file is lexed up front.
+} Workspace_Timings;
+
+// What the OS says a file is, so the same file under two different paths is still one file.
+typedef struct {
+    uint64_t device;
+    uint64_t inode;
+} File_Identity;
+
+// Every file gets parsed by its own job on the parse pool, with its own Parser and arena.
+typedef struct {
+    Workspace *workspace;
+    int file_index;
+    const char *path; // Copied into the arena. NULL if the source was handed to us directly.
+    bool merged; // Declarations are in the global block. A file can be #load'ed from many places, this is the first.
+    bool has_identity; // False for strings, and if the OS didn't give us one.
+    File_Identity identity;
+
+    Arena arena; // Everything this file allocates besides its syntax tree, it lives as long as the workspace.
+    Parser *parser; // Kept until its top-level declarations are merged, then freed and set to NULL.
+    Workspace_Timings timings;
+
+    // Big files get lexed in pieces on several threads first, whoever finishes the last piece
+    // goes on to parse the file. See parse_job_proc().
+    Token_Chunk *chunks;
+    size_t chunk_count;
+    size_t chunks_remaining; // Guarded by Workspace.files_mutex.
+    double lex_start;
+} Parse_Job;
+
+// What workspace_save() writes, next to the first file and named after it.
+enum {
+    OUTPUT_BITCODE = 0x1,  // .bc
+    OUTPUT_IR = 0x2,       // .llvm, the module as text.
+    OUTPUT_ASSEMBLY = 0x4, // .asm
+    OUTPUT_OBJECT = 0x8,   // .o
+};
+
 struct Workspace {
     const char *name;
     Llvm llvm;
     Ast_Block *global_block;
     Ast_Declaration **declarations;
-
-    Source_File *files;
+    Ast_Declaration **typecheck_queue; // Constants and globals that can make progress. @malloced with stb_ds
+    Mutex typecheck_mutex; // Guards typecheck_queue and the wait lists while declarations are typechecked on several threads.
+    Arena *typecheck_arenas; // One for each thread that typechecks, they live as long as the workspace. @malloced
+
+    Source_File *files; // Appended to from several threads while parsing, take files_mutex.
+    Parse_Job **parse_jobs; // One per file, indexed the same as files. Also guarded by files_mutex.
+    Mutex files_mutex;
+    Thread_Pool *parse_pool; // Only set while parsing.
+
+    bool pretokenize; // Lex each file into a Token_Stream before parsing it.
+    bool lazy_bodies; // Only match the braces of procedure bodies, and parse them when the typechecker first needs them.
+    int llvm_partition_count; // Build the procedures into this many modules on separate threads and link them, see workspace_llvm().
+    unsigned int outputs; // OUTPUT_* flags.
+    int optimization_level; // 0 to 3, like -O.
+    bool optimize_for_size; // -Os, which optimizes like level 2 but keeps the code small.
+    bool verify_llvm; // Run LLVMVerifyFunction on every procedure we build.
+    const char *target_triple; // NULL builds for this machine.
+    const char *target_cpu; // "" is the generic CPU of the target, "native" is this machine's CPU with all its features.
+    const char *target_features; // Like "+avx2,-fma", "" for the defaults of the CPU.
+    Workspace_Timings timings;
+
+    Atom_Table atoms;
+    Atom *atom_it;
+    Atom *atom_data;
+    Atom *atom_count;
+    Atom *atom_capacity;
 
     Ast_Type_Definition *type_def_int;
     Ast_Type_Definition *type_def_u8;
@@ -54,11 +141,19 @@ struct Workspace {
 
 void workspace_init(Workspace *w, const char *name);
 void workspace_add_file(Workspace *w, const char *path_as_cstr);
+int workspace_load_file(Workspace *w, const char *path_as_cstr);
 void workspace_add_string(Workspace *w, String_View input);
 void workspace_typecheck(Workspace *w);
+void workspace_parse_procedure_body(Workspace *w, Ast_Declaration *decl);
 void workspace_llvm(Workspace *w);
+void workspace_optimize_llvm(Workspace *w);
 void workspace_save(Workspace *w);
 
+void atom_table_init(Atom_Table *table);
+void atom_table_free(Atom_Table *table);
+Atom *workspace_intern(Workspace *w, String_View name, uint32_t hash);
+Atom *workspace_intern_cstr(Workspace *w, const char *name);
+
 void report_error(Workspace *workspace, Source_Location location, const char *format, ...);
 void report_info(Workspace *workspace, Source_Location location, const char *format, ...);
 
@@ -68,6 +163,14 @@ void workspace_setup_llvm(Workspace *w);
 void workspace_execute_llvm(Workspace *w);
 void workspace_dispose_llvm(Workspace *w);
 
+// Set on a thread while it builds one of the partitions, everything below builds into it instead of Workspace.llvm.
+extern _Thread_local Llvm *llvm_partition;
+
+Llvm *llvm_current(Workspace *w);
+void llvm_create_module(Llvm *llvm, const char *name, const char *triple);
+LLVMTargetMachineRef llvm_create_target_machine(Workspace *w, const char *triple);
+LLVMValueRef llvm_get_global_value(Workspace *w, LLVMValueRef value);
+
 LLVMValueRef llvm_get_named_value(LLVMValueRef function, const char *name);
 LLVMTypeRef llvm_get_packed_struct_type(Workspace *w, LLVMTypeRef struct_type);
 LLVMTypeRef llvm_get_type(Workspace *w, const Ast_Type_Definition *type_def);